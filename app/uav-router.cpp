@@ -1,5 +1,8 @@
+#include <algorithm>
+#include <csignal>
 #include <exception>
 #include <ioloop.h>
+#include <inc/config.h>
 #include <filters.h>
 #include <log.h>
 #include <err.h>
@@ -8,11 +11,14 @@
 #include <string>
 #include <regex>
 #include <tuple>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <chrono>
+#include <cstring>
 using namespace std::chrono_literals;
 
 
@@ -23,61 +29,353 @@ using namespace std::chrono_literals;
 
 Log::Log rlog {"router"};
 
-// Collection of endpoints to write the same stream of data
-class Destination : public Writeable {
+/*
+Matches endpoint names against route patterns: names and '/regex'.
+Patterns are compiled once. Exact names are looked up in a hash table,
+regexes are selected by their literal prefix with a trie and only those
+candidates run the compiled regex. Results are memoized per name, so
+repeated connects of the same name cost one hash lookup.
+*/
+class NameMatcher {
 public:
-    void add(const std::shared_ptr<Writeable> endpoint) {
-        endpoints[endpoint.get()] = endpoint;
+    void add(const std::string& pattern, int id) {
+        _cache.clear();
+        if (pattern.empty() || pattern[0]!='/') {
+            _exact[pattern].push_back(id);
+            return;
+        }
+        std::string rx = pattern.substr(1);
+        Tail tail;
+        std::string prefix = literal_prefix(rx, tail);
+        if (tail==Tail::NONE) {
+            _exact[prefix].push_back(id);
+            return;
+        }
+        int node = 0;
+        for(char c : prefix) {
+            node = child(node, c, true);
+        }
+        _trie[node].regexes.push_back(_regexes.size());
+        _regexes.push_back({tail==Tail::ANY ? std::regex() : std::regex(rx), id, tail==Tail::ANY});
     }
+
     void clear() {
-        endpoints.clear();
+        _exact.clear();
+        _trie.resize(1);
+        _trie[0] = TrieNode();
+        _regexes.clear();
+        _cache.clear();
     }
-    auto write(const void* buf, int len) -> int override {
-        if (endpoints.empty()) return 0;
-        if (endpoints.size()==1) {
-            if (endpoints.cbegin()->second.expired()) {
-                endpoints.clear();
-                return 0;
+
+    // sorted ids of patterns matching the name
+    auto match(const std::string& name) -> const std::vector<int>& {
+        auto cached = _cache.find(name);
+        if (cached!=_cache.end()) return cached->second;
+        if (_cache.size()>=MAX_CACHE) _cache.clear();
+        auto& ids = _cache[name];
+        auto exact = _exact.find(name);
+        if (exact!=_exact.end()) ids = exact->second;
+        int node = 0;
+        for(size_t i=0;;i++) {
+            for(int r : _trie[node].regexes) {
+                auto& entry = _regexes[r];
+                if (entry.any || std::regex_match(name, entry.rx)) ids.push_back(entry.id);
             }
-            return endpoints.cbegin()->second.lock()->write(buf,len);
-        }
-        for(auto endpoint = endpoints.cbegin(); endpoint != endpoints.cend();) {
-            if (endpoint->second.expired()) {
-                endpoint = endpoints.erase(endpoint);
-            } else {
-                endpoint->second.lock()->write(buf,len);
-                //TODO: partial writes
-                ++endpoint;
+            if (i==name.size()) break;
+            node = child(node, name[i], false);
+            if (node<0) break;
+        }
+        std::sort(ids.begin(),ids.end());
+        ids.erase(std::unique(ids.begin(),ids.end()),ids.end());
+        return ids;
+    }
+
+private:
+    enum class Tail { NONE, ANY, REGEX };
+    static constexpr size_t MAX_CACHE = 4096;
+
+    // literal beginning of regex and kind of the remaining part
+    static auto literal_prefix(const std::string& rx, Tail& tail) -> std::string {
+        std::string prefix;
+        tail = Tail::REGEX;
+        if (rx.find('|')!=std::string::npos) return prefix;
+        size_t i = 0;
+        for(;i<rx.size();i++) {
+            char c = rx[i];
+            if (std::strchr(".[]()*+?{}^$\\",c)) break;
+            prefix.push_back(c);
+        }
+        if (i==rx.size()) {
+            tail = Tail::NONE;
+        } else if (std::strchr("*+?{",rx[i]) && !prefix.empty()) {
+            prefix.pop_back(); // the last literal is quantified
+        } else if (rx.compare(i,std::string::npos,".*")==0) {
+            tail = Tail::ANY;
+        }
+        return prefix;
+    }
+
+    auto child(int node, char c, bool create) -> int {
+        for(auto& ch : _trie[node].children) {
+            if (ch.first==c) return ch.second;
+        }
+        if (!create) return -1;
+        int id = _trie.size();
+        _trie[node].children.emplace_back(c,id);
+        _trie.emplace_back();
+        return id;
+    }
+
+    struct TrieNode {
+        std::vector<std::pair<char,int>> children;
+        std::vector<int> regexes;
+    };
+    struct Regex {
+        std::regex rx;
+        int id;
+        bool any;
+    };
+    std::unordered_map<std::string,std::vector<int>> _exact;
+    std::vector<TrieNode> _trie = std::vector<TrieNode>(1);
+    std::vector<Regex> _regexes;
+    std::unordered_map<std::string,std::vector<int>> _cache;
+};
+
+// Collection of endpoints to write the same stream of data.
+// Nested destinations are flattened into one contiguous snapshot of strong
+// references. Membership changes only mark the tree dirty, the snapshot is
+// rebuilt once by the next write. An endpoint is held by a single shared
+// reference for all snapshots; the write path skips endpoints owned by it
+// alone and the next rebuild releases them.
+class Destination : public Writeable, public std::enable_shared_from_this<Destination> {
+public:
+    ~Destination() override {
+        for(auto& parent : parents) {
+            if (auto p = parent.lock()) p->invalidate();
+        }
+    }
+    void add(const std::shared_ptr<Writeable>& endpoint) {
+        if (!endpoint) return;
+        if (auto dest = std::dynamic_pointer_cast<Destination>(endpoint)) {
+            if (dest.get()==this) return;
+            children.emplace_back(dest);
+            dest->parents.emplace_back(weak_from_this());
+        } else {
+            members.push_back({endpoint.get(),endpoint});
+        }
+        invalidate(); // duplicates are dropped by the rebuild
+    }
+    void clear() {
+        for(auto& child : children) {
+            auto dest = child.lock();
+            if (!dest) continue;
+            auto& p = dest->parents;
+            p.erase(std::remove_if(p.begin(),p.end(),[this](auto& w){ 
+                auto ptr = w.lock();
+                return !ptr || ptr.get()==this;
+            }), p.end());
+        }
+        children.clear();
+        members.clear();
+        invalidate();
+        rebuild(); // release the endpoints now, nothing else to collect
+    }
+    auto write(const void* buf, int len) -> int override {
+        if (dirty) rebuild();
+        auto* snap = snapshot.get();
+        if (snap->entries.empty()) return 0;
+        int ret = len;
+        bool expired = false;
+        writing++;
+        for(auto& entry : snap->entries) {
+            // the snapshot keeps the endpoint alive: a sink may release its siblings while writing
+            if (entry.ref->use_count()==1) {
+                expired = true;
+                continue;
             }
+            int n = entry.ptr->write(buf,len);
+            //TODO: partial writes
+            if (snap->entries.size()==1) ret = n;
         }
-        return len;
+        if (--writing==0) retired.clear();
+        if (expired) invalidate();
+        return ret;
+    }
+    bool empty() { return members.empty() && children.empty();
     }
-    bool empty() { return endpoints.empty();
+    // the only endpoint of the tree if it is a byte stream: data written
+    // here unchanged may be spliced to it by the source
+    auto splice_sink() -> Spliceable* {
+        if (dirty) rebuild();
+        auto& entries = snapshot->entries;
+        if (!sink || entries.size()!=1 || entries.front().ref->use_count()==1) return nullptr;
+        return sink;
     }
 private:
-    std::map<Writeable*,std::weak_ptr<Writeable>> endpoints;
+    struct Member {
+        Writeable* ptr;
+        std::weak_ptr<Writeable> ref;
+    };
+    struct Held {
+        std::shared_ptr<Writeable> ref;
+        int snapshots = 0;
+    };
+    struct Entry {
+        Writeable* ptr;
+        const std::shared_ptr<Writeable>* ref; // in the held map, nodes are stable
+    };
+    // entries are released when the last snapshot holding them is destroyed
+    struct Snapshot {
+        std::vector<Entry> entries;
+        void hold(const std::shared_ptr<Writeable>& endpoint) {
+            auto& h = held[endpoint.get()];
+            if (!h.ref) h.ref = endpoint;
+            h.snapshots++;
+            entries.push_back({endpoint.get(),&h.ref});
+        }
+        ~Snapshot() {
+            std::vector<std::shared_ptr<Writeable>> released;
+            for(auto& entry : entries) {
+                auto it = held.find(entry.ptr);
+                if (--it->second.snapshots) continue;
+                released.push_back(std::move(it->second.ref));
+                held.erase(it);
+            }
+            // endpoint destructors may rebuild other destinations, held is consistent here
+        }
+    };
+    // shared by all destinations to hold each endpoint by one reference
+    inline static std::unordered_map<Writeable*, Held> held;
+
+    static bool alive(const Member& member) {
+        auto it = held.find(member.ptr);
+        if (it!=held.end()) return it->second.ref.use_count()>1;
+        return !member.ref.expired();
+    }
+
+    void invalidate() {
+        if (dirty) return;
+        dirty = true;
+        for(auto& parent : parents) {
+            if (auto p = parent.lock()) p->invalidate();
+        }
+    }
+
+    // seen holds endpoints and destinations already collected, it breaks loops
+    void collect(Snapshot& out, std::unordered_set<const void*>& seen) {
+        if (!seen.insert(this).second) return;
+        for(auto& member : members) {
+            if (!alive(member) || seen.count(member.ptr)) continue;
+            if (auto endpoint = member.ref.lock()) {
+                seen.insert(member.ptr);
+                out.hold(endpoint);
+            }
+        }
+        for(auto& child : children) {
+            if (auto dest = child.lock()) dest->collect(out, seen);
+        }
+    }
+
+    void rebuild() {
+        dirty = false;
+        std::unordered_set<const void*> seen;
+        members.erase(std::remove_if(members.begin(),members.end(),[&seen](auto& m){
+            return !alive(m) || !seen.insert(m.ptr).second;
+        }), members.end());
+        children.erase(std::remove_if(children.begin(),children.end(),[&seen](auto& c){
+            auto dest = c.lock();
+            return !dest || !seen.insert(dest.get()).second;
+        }), children.end());
+        parents.erase(std::remove_if(parents.begin(),parents.end(),[](auto& p){ return p.expired(); }), parents.end());
+        seen.clear();
+        auto snap = std::make_unique<Snapshot>();
+        collect(*snap, seen);
+        auto& entries = snap->entries;
+        sink = entries.size()==1 ? dynamic_cast<Spliceable*>(entries.front().ptr) : nullptr;
+        // the previous snapshot may be walked by write() now
+        if (writing) retired.push_back(std::move(snapshot));
+        snapshot = std::move(snap);
+    }
+
+    std::vector<Member> members;
+    std::vector<std::weak_ptr<Destination>> children;
+    std::vector<std::weak_ptr<Destination>> parents;
+    std::unique_ptr<Snapshot> snapshot = std::make_unique<Snapshot>();
+    std::vector<std::unique_ptr<Snapshot>> retired;
+    Spliceable* sink = nullptr;
+    int writing = 0;
+    bool dirty = false;
 };
 
 class EndpointStore {
 public:
     // add regex or endpoint name to table of endpoints
     void register_name(const std::string& name) {
-        auto& d = endpoints[name] = std::make_shared<Destination>();
+        auto& d = endpoints[name];
+        if (d) return;
+        d = std::make_shared<Destination>();
+        int id = -1;
         if (name[0]=='/') {
-            regex_endpoints.emplace_back(std::make_pair(std::regex(name.substr(1)),d));
+            id = regex_endpoints.size();
+            regex_endpoints.emplace_back(name,d);
+            regex_matcher.add(name,id);
+        }
+        // connect write ends registered before the name appeared
+        for(auto it = write_ends.begin(); it!=write_ends.end();) {
+            auto sink = it->second.lock();
+            if (!sink) {
+                it = write_ends.erase(it);
+                continue;
+            }
+            if (id!=-1) {
+                auto& ids = regex_matcher.match(it->first);
+                if (std::binary_search(ids.begin(),ids.end(),id)) d->add(sink);
+            } else if (it->first==name) {
+                d->add(sink);
+            }
+            ++it;
         }
     }
 
-    void register_write_end(const std::string& name, std::shared_ptr<Writeable> sink) {
-        auto& endpoint = endpoints[name];
-        if (endpoint) { endpoint->add(sink);
+    // keep only names from the set, destinations of kept names stay untouched
+    void update_names(const std::set<std::string>& names) {
+        bool regex_removed = false;
+        for(auto it = endpoints.begin(); it!=endpoints.end();) {
+            if (names.count(it->first)) {
+                ++it;
+                continue;
+            }
+            if (it->first[0]=='/') {
+                regex_removed = true;
+                auto& name = it->first;
+                regex_endpoints.erase(std::remove_if(regex_endpoints.begin(), regex_endpoints.end(),
+                    [&name](auto& entry){ return entry.first==name; }), regex_endpoints.end());
+            }
+            it = endpoints.erase(it);
         }
-        std::smatch match;
-        for(auto& entry : regex_endpoints) {
-            if (std::regex_match(name,match,entry.first)) {
-                entry.second->add(sink);
+        if (regex_removed) {
+            regex_matcher.clear();
+            for(int i=0;i<int(regex_endpoints.size());i++) {
+                regex_matcher.add(regex_endpoints[i].first,i);
             }
         }
+        for(auto& name : names) {
+            register_name(name);
+        }
+    }
+
+    void register_write_end(const std::string& name, std::shared_ptr<Writeable> sink) {
+        if (write_ends.size()>=write_ends_mark) { // transient clients leave expired entries
+            write_ends.erase(std::remove_if(write_ends.begin(),write_ends.end(),[](auto& e){ return e.second.expired(); }),write_ends.end());
+            write_ends_mark = std::max<std::size_t>(64,write_ends.size()*2);
+        }
+        write_ends.emplace_back(name,sink);
+        auto it = endpoints.find(name);
+        if (it!=endpoints.end() && it->second) { it->second->add(sink);
+        }
+        for(int id : regex_matcher.match(name)) {
+            regex_endpoints[id].second->add(sink);
+        }
     }
 
     void connect_to_dest(const std::string& name, std::shared_ptr<Destination>& dest) {
@@ -86,27 +384,50 @@ public:
             dest->add(ptr->second);
         }
         if (name[0]=='/') return;
-        std::smatch match;
-        for(auto& entry : regex_endpoints) {
-            if (std::regex_match(name,match,entry.first)) {
-                dest->add(entry.second);
-            }
+        for(int id : regex_matcher.match(name)) {
+            dest->add(regex_endpoints[id].second);
         }
     }
 
     void clear() {
         endpoints.clear();
         regex_endpoints.clear();
+        regex_matcher.clear();
+        write_ends.clear();
     }
 
 private:
     std::map<std::string,std::shared_ptr<Destination>> endpoints;
-    std::vector<std::pair<std::regex,std::shared_ptr<Destination>>> regex_endpoints;
+    std::vector<std::pair<std::string,std::shared_ptr<Destination>>> regex_endpoints;
+    NameMatcher regex_matcher; // ids are indexes in regex_endpoints
+    std::vector<std::pair<std::string,std::weak_ptr<Writeable>>> write_ends;
+    std::size_t write_ends_mark = 64;
 };
 
 EndpointStore endpoint_store;
 
-std::vector<std::tuple<std::string,std::string,YAML::Node>> routes;
+// source name, route name, dst, hash of route name and dst to compare routes on reload
+using Route = std::tuple<std::string,std::string,YAML::Node,std::size_t>;
+std::vector<Route> routes;
+NameMatcher route_matcher; // ids are indexes in routes
+StatHandler* stat_handler = nullptr;
+
+void register_filter_stat(YAML::Node cfg, const std::shared_ptr<Filter>& filter) {
+    auto statcfg = cfg["stat"];
+    if (!stat_handler || !statcfg || !statcfg.IsMap()) return;
+    auto period = duration(statcfg["period"]);
+    if (!period.count()) return;
+    auto stat = filter->stat();
+    if (!stat) return;
+    auto tags = statcfg["tags"];
+    if (tags && tags.IsMap()) {
+        for(auto tag : tags) {
+            stat->add_tag(std::make_pair(tag.first.as<std::string>(),tag.second.as<std::string>()));
+        }
+    }
+    if (cfg["name"]) stat->add_tag({"filter",cfg["name"].as<std::string>()});
+    stat_handler->register_report(stat, period);
+}
 
 bool construct_route(YAML::Node cfg, std::shared_ptr<Destination>& dest, std::vector<std::shared_ptr<Filter>>& filters) {
     if (cfg.IsScalar())  {
@@ -133,6 +454,7 @@ bool construct_route(YAML::Node cfg, std::shared_ptr<Destination>& dest, std::ve
         return false;
     }
     filters.push_back(filter);
+    register_filter_stat(cfg, filter);
     auto dst = cfg["dst"];
     if (dst) {
         auto next = std::make_shared<Destination>();
@@ -149,36 +471,33 @@ bool construct_route(YAML::Node cfg, std::shared_ptr<Destination>& dest, std::ve
     return true;
 }
 
-bool equal_name(const std::string& pattern, const std::string& name) {
-    if (pattern[0]=='/') {
-        std::regex rg(pattern.substr(1));
-        std::smatch match;
-        return std::regex_match(name,match,rg);
+void construct_routes(const std::string& name, std::shared_ptr<Destination>& dest, std::vector<std::shared_ptr<Filter>>& filters) {
+    for(int id : route_matcher.match(name)) {
+        construct_route(std::get<2>(routes[id]), dest, filters);
     }
-    return pattern==name;
 }
 
-void construct_routes(const std::string& name, std::shared_ptr<Destination>& dest, std::vector<std::shared_ptr<Filter>>& filters) {
-    for(auto& route: routes) {
-        auto [endpoint_name, route_name, dst] = route;
-        if (equal_name(endpoint_name, name)) {
-            construct_route(dst, dest, filters);
-        }
+// Describes routes applied to the endpoint, the same value means the same route graph
+auto route_signature(const std::string& name) -> std::size_t {
+    std::size_t signature = 0;
+    for(int id : route_matcher.match(name)) {
+        signature = signature*31 + std::get<3>(routes[id]);
     }
+    return signature;
 }
 
 /*
-Fill named_endpoints & regex_endpoints
+Collect endpoint names & regexes
 */
-bool scan_dst(YAML::Node cfg) {
+bool scan_dst(YAML::Node cfg, std::set<std::string>& names) {
     if (!cfg) return false;
     if (cfg.IsScalar()) {
-        endpoint_store.register_name(cfg.as<std::string>());
+        names.insert(cfg.as<std::string>());
         return true;
     }
     if (cfg.IsSequence()) {
         for(auto name : cfg) {
-            if (!scan_dst(name)) return false;
+            if (!scan_dst(name,names)) return false;
         }
         return true;
     }
@@ -188,10 +507,10 @@ bool scan_dst(YAML::Node cfg) {
         if (!dst && !rest) { return false;
         }
         if (dst) {
-            if (!scan_dst(dst)) return false;
+            if (!scan_dst(dst,names)) return false;
         }
         if (rest) {
-            if (!scan_dst(rest)) return false;
+            if (!scan_dst(rest,names)) return false;
         }
         return true;
     }
@@ -199,9 +518,9 @@ bool scan_dst(YAML::Node cfg) {
 }
 
 /*
-Fill routes, named_endpoints & regex_endpoints
+Fill routes and names of destination endpoints
 */
-bool load_routes(YAML::Node cfg) {
+bool load_routes(YAML::Node cfg, std::vector<Route>& routes, std::set<std::string>& names) {
     if (!cfg) {
         Log::error()<<"No routes section described"<<std::endl;
         return false;
@@ -216,7 +535,7 @@ bool load_routes(YAML::Node cfg) {
             continue;
         }
         auto dst = route.second["dst"];
-        if (!scan_dst(dst)) {
+        if (!scan_dst(dst,names)) {
             Log::error()<<"Route "<<route.first.as<std::string>()<<" has wrong dst"<<std::endl;
             continue;
         }
@@ -226,13 +545,14 @@ bool load_routes(YAML::Node cfg) {
             Log::error()<<"Route "<<route.first.as<std::string>()<<" has no src"<<std::endl;
             continue;
         }
+        auto hash = std::hash<std::string>{}(route.first.as<std::string>() + '\n' + YAML::Dump(dst));
         if (src.IsScalar()) {
-            routes.emplace_back(std::make_tuple(src.as<std::string>(), route.first.as<std::string>(),dst));
+            routes.emplace_back(std::make_tuple(src.as<std::string>(), route.first.as<std::string>(),dst,hash));
             continue;
         }
         if (src.IsSequence()) {
             for(auto name : src) {
-                routes.emplace_back(std::make_tuple(name.as<std::string>(), route.first.as<std::string>(),dst));
+                routes.emplace_back(std::make_tuple(name.as<std::string>(), route.first.as<std::string>(),dst,hash));
             }
         }
     }
@@ -243,6 +563,8 @@ struct SourceEntry {
     std::shared_ptr<StreamSource> connection;
     std::shared_ptr<Destination> destination;
     std::vector<std::shared_ptr<Filter>> filters;
+    std::string config; // endpoint type and settings the connection was created with
+    std::size_t routes = 0; // route_signature() of the destination
     SourceEntry() : destination(std::make_shared<Destination>()) {}
 };
 
@@ -250,16 +572,24 @@ struct ClientEntry {
     std::shared_ptr<Client> client;
     std::shared_ptr<Destination> destination;
     std::vector<std::shared_ptr<Filter>> filters;
+    std::string source;
+    std::size_t routes = 0;
     ClientEntry() : destination(std::make_shared<Destination>()) {}
 };
 
+struct FileEntry {
+    std::shared_ptr<OFileStream> file;
+    std::string config;
+};
+
 std::map<std::string, SourceEntry> source_entries;
 std::map<std::string, ClientEntry> client_entries;
-std::vector<std::shared_ptr<OFileStream>> file_entries;
+std::map<std::string, FileEntry> file_entries;
 
 void setup_endpoint(const std::string& name, std::shared_ptr<StreamSource> endpoint, bool register_write_end = true) {
     auto& entry = source_entries[name];
     entry.connection = std::move(endpoint);
+    entry.routes = route_signature(name);
     construct_routes(name,entry.destination,entry.filters);
     entry.connection->on_error([name](const error_c& ec) {
         rlog.error()<<"Endpoint ["<<name<<"]:"<<ec<<std::endl;
@@ -271,7 +601,10 @@ void setup_endpoint(const std::string& name, std::shared_ptr<StreamSource> endpo
         }
         auto& client = client_entries[cli_name];
         client.client = cli;
+        client.source = name;
+        client.routes = route_signature(cli_name);
         client.destination->clear();
+        client.filters.clear();
         construct_routes(cli_name,client.destination,client.filters);
         client.destination->add(entry.destination);
         cli->on_close([cli_name](){
@@ -280,23 +613,74 @@ void setup_endpoint(const std::string& name, std::shared_ptr<StreamSource> endpo
         cli->on_read([&client](void* buf, int len){
             client.destination->write(buf,len);
         });
+        cli->on_splice([&client](){
+            return client.destination->splice_sink();
+        });
         cli->on_error([&entry, cli_name](error_c& ec) {
             entry.connection->on_error(ec,cli_name);
         });
     });
 }
 
+// Destroys the endpoint and routes of its clients
+void remove_endpoint(const std::string& name) {
+    for(auto it = client_entries.begin(); it!=client_entries.end();) {
+        if (it->second.source!=name) {
+            ++it;
+            continue;
+        }
+        auto& cli = it->second.client;
+        cli->on_read(nullptr);
+        cli->on_splice(nullptr);
+        cli->on_close(nullptr);
+        cli->on_error(nullptr);
+        it = client_entries.erase(it);
+    }
+    source_entries.erase(name);
+}
+
+// Rebuilds routes of endpoints and clients whose set of routes changed.
+// Unchanged routes keep their filters with parser state.
+void update_routes() {
+    for(auto& [name, entry] : source_entries) {
+        auto signature = route_signature(name);
+        if (signature==entry.routes) continue;
+        rlog.info()<<"Update routes of endpoint "<<name<<std::endl;
+        entry.routes = signature;
+        entry.destination->clear();
+        entry.filters.clear();
+        construct_routes(name,entry.destination,entry.filters);
+    }
+    for(auto& [name, client] : client_entries) {
+        auto signature = route_signature(name);
+        if (signature==client.routes) continue;
+        rlog.info()<<"Update routes of client "<<name<<std::endl;
+        client.routes = signature;
+        client.destination->clear();
+        client.filters.clear();
+        construct_routes(name,client.destination,client.filters);
+        auto source = source_entries.find(client.source);
+        if (source!=source_entries.end()) client.destination->add(source->second.destination);
+    }
+}
+
+/*
+Create endpoints absent in source_entries and file_entries,
+recreate endpoints with changed settings and remove endpoints not in cfg
+*/
 bool load_endpoints(std::unique_ptr<IOLoop>& loop, YAML::Node cfg) {
     if (!cfg) return false;
     if (!cfg.IsMap()) return false;
-    enum EndpointType { UART, TCPSVR, TCPCLI, UDPSVR};
+    enum EndpointType { UART, TCPSVR, TCPCLI, UDPSVR, UDPCLI, TUNNEL, UNIXSVR, UNIXCLI, SHMRING, PTY};
     std::vector<std::pair<EndpointType,YAML::Node>> data;
-    if (!cfg) return false;
-    if (!cfg.IsMap()) return false;
     auto uart = cfg["uart"];
     if (uart.IsMap()) {
         data.push_back(std::make_pair(EndpointType::UART, uart));
     }
+    auto pty = cfg["pty"];
+    if (pty.IsMap()) {
+        data.push_back(std::make_pair(EndpointType::PTY, pty));
+    }
     auto tcp = cfg["tcp"];
     if (tcp.IsMap()) {
         auto clients = tcp["clients"];
@@ -312,65 +696,124 @@ bool load_endpoints(std::unique_ptr<IOLoop>& loop, YAML::Node cfg) {
     if (udp.IsMap()) {
         auto clients = udp["clients"];
         if (clients.IsMap()) {
-            // create udp clients
-            for(auto client : clients) {
-                auto name = client.first.as<std::string>();
-                try {
-                    auto endpoint = loop->udp_client(name);
-                    if (endpoint) {
-                        error_c ret = endpoint->init_yaml(client.second);
-                        if (ret) { rlog.error()<<"Init udp client endpoint "<<name<<" error "<<ret<<std::endl;
-                        } else { 
-                            std::shared_ptr<UdpClient> c = std::move(endpoint);
-                            endpoint_store.register_write_end(name,c);
-                            setup_endpoint(name,c,false);
-                        }
-                    }
-                } catch(std::exception &e) {
-                    rlog.error()<<"Exception while construct udp client "<<name<<" "<<e.what()<<std::endl;
-                }
-            }
+            data.push_back(std::make_pair(EndpointType::UDPCLI, clients));
         }
         auto servers = udp["servers"];
         if (servers.IsMap()) {
             data.push_back(std::make_pair(EndpointType::UDPSVR, servers));
         }
     }
+    auto local = cfg["unix"];
+    if (local.IsMap()) {
+        auto clients = local["clients"];
+        if (clients.IsMap()) {
+            data.push_back(std::make_pair(EndpointType::UNIXCLI, clients));
+        }
+        auto servers = local["servers"];
+        if (servers.IsMap()) {
+            data.push_back(std::make_pair(EndpointType::UNIXSVR, servers));
+        }
+    }
+    auto ring = cfg["ring"];
+    if (ring.IsMap()) {
+        data.push_back(std::make_pair(EndpointType::SHMRING, ring));
+    }
+    auto tunnel = cfg["tunnel"];
+    if (tunnel.IsMap()) {
+        data.push_back(std::make_pair(EndpointType::TUNNEL, tunnel));
+    }
+    std::map<std::string,std::string> configs;
+    for (auto& item : data) {
+        for(auto endp : item.second) {
+            configs[endp.first.as<std::string>()] = std::to_string(item.first) + '\n' + YAML::Dump(endp.second);
+        }
+    }
+    for(auto it = source_entries.begin(); it!=source_entries.end();) {
+        auto cfg_it = configs.find(it->first);
+        if (cfg_it!=configs.end() && cfg_it->second==it->second.config) {
+            ++it;
+            continue;
+        }
+        auto name = (it++)->first;
+        rlog.info()<<"Remove endpoint "<<name<<std::endl;
+        remove_endpoint(name);
+    }
     for (auto& item : data) {
         for(auto endp : item.second) {
             auto name = endp.first.as<std::string>();
+            if (source_entries.count(name)) continue;
             try {
+                if (item.first==UDPCLI) {
+                    // create udp clients
+                    auto endpoint = loop->udp_client(name);
+                    if (endpoint) {
+                        error_c ret = endpoint->init_yaml(endp.second);
+                        if (ret) { rlog.error()<<"Init udp client endpoint "<<name<<" error "<<ret<<std::endl;
+                        } else { 
+                            std::shared_ptr<UdpClient> c = std::move(endpoint);
+                            endpoint_store.register_write_end(name,c);
+                            setup_endpoint(name,c,false);
+                            source_entries[name].config = configs[name];
+                        }
+                    }
+                    continue;
+                }
                 std::unique_ptr<StreamSource> endpoint;
                 switch(item.first) {
                 case UART: endpoint = loop->uart(name); break;
                 case TCPSVR: endpoint = loop->tcp_server(name); break;
                 case TCPCLI: endpoint = loop->tcp_client(name); break;
                 case UDPSVR: endpoint = loop->udp_server(name); break;
+                case TUNNEL: endpoint = loop->tunnel(name); break;
+                case UNIXSVR: endpoint = loop->unix_server(name); break;
+                case UNIXCLI: endpoint = loop->unix_client(name); break;
+                case SHMRING: endpoint = loop->shm_ring(name); break;
+                case PTY: endpoint = loop->pty(name); break;
+                default: break;
                 }
                 if (endpoint) {
                     error_c ret = endpoint->init_yaml(endp.second);
                     if (ret) { rlog.error()<<"Init endpoint "<<name<<" error "<<ret<<std::endl;
-                    } else {   setup_endpoint(name,std::move(endpoint));
+                    } else {
+                        setup_endpoint(name,std::move(endpoint));
+                        source_entries[name].config = configs[name];
                     }
                 }
             } catch(std::exception &e) {
-                rlog.error()<<"Exception while construct uart "<<name<<" "<<e.what()<<std::endl;
+                rlog.error()<<"Exception while construct endpoint "<<name<<" "<<e.what()<<std::endl;
             }
         }
     }
     auto files = cfg["file"];
+    std::map<std::string,std::string> file_configs;
+    if (files.IsMap()) {
+        for(auto file : files) {
+            if (file.second.IsMap()) file_configs[file.first.as<std::string>()] = YAML::Dump(file.second);
+        }
+    }
+    for(auto it = file_entries.begin(); it!=file_entries.end();) {
+        auto cfg_it = file_configs.find(it->first);
+        if (cfg_it==file_configs.end() || cfg_it->second!=it->second.config) {
+            rlog.info()<<"Remove file endpoint "<<it->first<<std::endl;
+            it = file_entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
     if (files.IsMap()) {
         //create files
         for(auto file : files) {
-            if (file.second.IsMap()) {
+            auto name = file.first.as<std::string>();
+            if (file.second.IsMap() && !file_entries.count(name)) {
                 auto f = loop->outfile();
                 error_c ret = f->init_yaml(file.second);
-                auto name = file.first.as<std::string>();
                 if (ret)  {
                     rlog.error()<<"Init file endpoint "<<name<<" error "<<ret<<std::endl;
                 } else {
-                    auto& of = file_entries.emplace_back(std::move(f));
-                    endpoint_store.register_write_end(name,of);
+                    auto& of = file_entries[name];
+                    of.file = std::move(f);
+                    of.config = file_configs[name];
+                    endpoint_store.register_write_end(name,of.file);
                 }
             }
         }
@@ -396,6 +839,17 @@ void load_loggers(YAML::Node cfg) {
         {"debug", Log::Level::DEBUG}
     };
     if (cfg && cfg.IsMap()) {
+        auto output = cfg["output"];
+        if (output && output.IsScalar()) {
+            auto target = output.as<std::string>();
+            if (!Log::output(target)) {
+                std::cerr<<"Log output "<<target<<" error "<<strerror(errno)<<std::endl;
+            }
+        }
+        auto rate = cfg["rate"];
+        if (rate && rate.IsScalar()) {
+            Log::rate_limit(rate.as<int>());
+        }
         for(auto& item : levels) {
             auto chapter = cfg[item.first];
             if (!chapter) continue;
@@ -442,6 +896,62 @@ std::string expand_shell_variables(std::string data) {
     return std::move(data);
 }
 
+auto load_config(const std::string& file_name) -> YAML::Node {
+    std::string expanded = expand_shell_variables(read_file(file_name));
+    if (expanded.empty()) return YAML::Node();
+    try {
+        return YAML::Load(expanded);
+    } catch(std::exception &e) {
+        rlog.error()<<"Config file "<<file_name<<" parse error "<<e.what()<<std::endl;
+    }
+    return YAML::Node();
+}
+
+/*
+Replace routes and the table of destination names.
+Name of stats output endpoint is kept in the table too.
+*/
+bool apply_routes(YAML::Node config) {
+    std::vector<Route> new_routes;
+    std::set<std::string> names;
+    if (!load_routes(config["routes"], new_routes, names)) return false;
+    auto stat_cfg = config["stats"];
+    if (stat_cfg && stat_cfg.IsMap()) {
+        auto endpoint = stat_cfg["endpoint"];
+        if (endpoint && endpoint.IsScalar()) names.insert(endpoint.as<std::string>());
+    }
+    routes = std::move(new_routes);
+    route_matcher.clear();
+    for(int i=0;i<int(routes.size());i++) {
+        route_matcher.add(std::get<0>(routes[i]),i);
+    }
+    endpoint_store.update_names(names);
+    return true;
+}
+
+YAML::Node endpoints_config;
+bool endpoints_ready = false;
+
+/*
+Apply changed config without restart: only endpoints with changed settings
+are recreated and only changed routes are rebuilt
+*/
+void reload_config(std::unique_ptr<IOLoop>& loop, const std::string& file_name) {
+    rlog.info()<<"Reload config file "<<file_name<<std::endl;
+    auto config = load_config(file_name);
+    if (!config) return;
+    load_loggers(config["logging"]);
+    if (!apply_routes(config)) {
+        rlog.error()<<"Routes are not loaded, keep previous configuration"<<std::endl;
+        return;
+    }
+    endpoints_config = config["endpoints"];
+    if (endpoints_ready && !load_endpoints(loop, endpoints_config)) {
+        rlog.error()<<"Error loading endpoints"<<std::endl;
+    }
+    update_routes();
+}
+
 #ifdef USING_SENTRY
 static void
 print_envelope(sentry_envelope_t *envelope, void *unused_state)
@@ -486,9 +996,8 @@ int main(int argc, char *argv[]) {
         config_file_name = argv[1];
     }
     std::cerr<<"Load config file "<<config_file_name<<std::endl;
-    std::string expanded = std::move(expand_shell_variables(read_file(config_file_name)));
-    if (expanded.empty()) return 1;
-    YAML::Node config = YAML::Load(expanded);
+    YAML::Node config = load_config(config_file_name);
+    if (!config) return 1;
     auto global_cfg = config["config"];
     if (global_cfg && global_cfg.IsMap()) {
 #ifdef USING_SENTRY
@@ -533,9 +1042,12 @@ int main(int argc, char *argv[]) {
         }
     }
     load_loggers(config["logging"]);
-    if (!load_routes(config["routes"])) return 2;
-    loop->zeroconf_ready([&loop,endpoints = config["endpoints"]](){
-        if (!load_endpoints(loop, endpoints)) {
+    stat_handler = loop->stats();
+    if (!apply_routes(config)) return 2;
+    endpoints_config = config["endpoints"];
+    loop->zeroconf_ready([&loop](){
+        endpoints_ready = true;
+        if (!load_endpoints(loop, endpoints_config)) {
             std::cerr<<"Error creating endpoints. Stop."<<std::endl;
             loop->stop();
         }    
@@ -543,7 +1055,12 @@ int main(int argc, char *argv[]) {
     auto stat_cfg = config["stats"];
     if (stat_cfg && stat_cfg.IsMap()) {
         auto endpoint = stat_cfg["endpoint"];
-        if (endpoint && endpoint.IsScalar()) {
+        if (stat_cfg["http"]) {
+            error_c ec = loop->stats()->init_yaml(nullptr, stat_cfg);
+            if (ec) {
+                std::cerr<<"Stats http output error "<<ec<<std::endl;
+            }
+        } else if (endpoint && endpoint.IsScalar()) {
             auto output = std::make_shared<Destination>();
             endpoint_store.connect_to_dest(endpoint.as<std::string>(),output);
             if (!output->empty()) {
@@ -551,6 +1068,39 @@ int main(int argc, char *argv[]) {
                 stats->init_yaml(output, stat_cfg);
             }
         }
+        auto shm = stat_cfg["shm"];
+        if (shm) {
+            std::string name = "uav-router";
+            int capacity = 1024;
+            if (shm.IsScalar()) { name = shm.as<std::string>();
+            } else if (shm.IsMap()) {
+                if (shm["name"]) name = shm["name"].as<std::string>();
+                if (shm["entries"]) capacity = shm["entries"].as<int>();
+            }
+            error_c ec = loop->stats()->share(name, capacity);
+            if (ec) {
+                std::cerr<<"Shared stats segment error "<<ec<<std::endl;
+            }
+        }
+        auto prometheus = stat_cfg["prometheus"];
+        if (prometheus && prometheus.IsMap()) {
+            std::string address;
+            if (prometheus["address"]) address = prometheus["address"].as<std::string>();
+            uint16_t port = 9273;
+            if (prometheus["port"]) port = prometheus["port"].as<int>();
+            error_c ec = loop->stats()->expose(port, address);
+            if (ec) {
+                std::cerr<<"Prometheus endpoint error "<<ec<<std::endl;
+            }
+        }
+    }
+    auto reload = loop->signal_handler();
+    error_c ec = reload->init({SIGHUP}, [&loop, &config_file_name](signalfd_siginfo* si) {
+        reload_config(loop, config_file_name);
+        return true;
+    });
+    if (ec) {
+        std::cerr<<"SIGHUP handler error "<<ec<<std::endl;
     }
     loop->run();
     cleanup();
@@ -3,6 +3,7 @@
 #include "filters/rtcm3.h"
 #include "filters/ubx.h"
 #include "filters/hex.h"
+#include "filters/compress.h"
 #include "log.h"
 #include <memory>
 
@@ -14,6 +15,8 @@ namespace Filters {
         if (name=="rtcm3") return std::make_shared<RTCM_v3>();
         if (name=="ubx") return std::make_shared<UBX>();
         if (name=="hex") return std::make_shared<Hex>();
+        if (name=="compress") return std::make_shared<Compress>();
+        if (name=="decompress") return std::make_shared<Decompress>();
         return std::shared_ptr<Filter>();
     }
 #ifdef  YAML_CONFIG
@@ -0,0 +1,283 @@
+#ifndef __COMPRESS__H__
+#define __COMPRESS__H__
+#include "../inc/endpoints.h"
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "filterbase.h"
+#include "mavlink1.h"
+
+// Delta compression of packet streams.
+// Every written packet is one record. A record is encoded against the
+// previous record with the same key (MAVLink sysid/compid/msgid or the
+// record length for other data): the XOR difference is packed with zero
+// run-length encoding. Both sides keep the same table of previous records,
+// so the table works as a shared dictionary built on the fly.
+// Records are never buffered, so the only added latency is the codec time.
+//
+// Frame: magic, type, slot, seq, length (16 bit, big endian), payload,
+// crc16 (little endian) of type..payload.
+
+namespace delta {
+
+constexpr uint8_t MAGIC = 0xC5;
+constexpr int HEADER = 6;
+constexpr int CRC = 2;
+enum Type : uint8_t { LITERAL=0, DELTA=1 };
+
+struct Slot {
+    uint32_t key = 0;
+    uint8_t seq = 0;
+    bool valid = false;
+    int count = 0;
+    std::vector<uint8_t> data;
+};
+
+inline auto key(const uint8_t* buf, int len) -> uint32_t {
+    if (len>=8 && buf[0]==Mavlink_v1::STX && len==buf[1]+8) {
+        return 0x01000000 | (buf[3]<<16) | (buf[4]<<8) | buf[5];
+    }
+    return 0x02000000 | len;
+}
+
+inline auto slot(uint32_t key) -> uint8_t {
+    return (key ^ (key>>8)*31 ^ (key>>16)*7) & 0xFF;
+}
+
+} // namespace delta
+
+// Collects codec statistic of a link: raw and packed bytes, compression
+// ratio (packed/raw) and time spent in codec per record
+class CodecStat : public Stat {
+public:
+    CodecStat(std::string name, std::shared_ptr<StatCounters> cnt):_name(std::move(name)),_cnt(std::move(cnt)) {}
+    void report(OStat& out) override {
+        auto& meter = metric(_name);
+        if (records) {
+            meter.add_field("raw", raw);
+            meter.add_field("packed", packed);
+            meter.add_field("ratio", raw ? double(packed)/raw : 0.);
+            meter.add_field("records", records);
+            meter.add_field("latency", time/records);
+            meter.add_field("latency_max", time_max);
+        }
+        _cnt->report(meter);
+        out.send(meter);
+        raw = packed = records = 0;
+        time = time_max = std::chrono::nanoseconds::zero();
+    }
+    void expose(OExpose& out) override {
+        _cnt->expose(out, _name, labels());
+    }
+    void share(std::shared_ptr<StatShare> shm) override {
+        _cnt->set_tags(tags());
+        _cnt->share(std::move(shm));
+    }
+    void add(int raw_len, int packed_len, std::chrono::nanoseconds t) {
+        raw += raw_len;
+        packed += packed_len;
+        records++;
+        time += t;
+        if (t>time_max) time_max = t;
+    }
+    long long int raw = 0;
+    long long int packed = 0;
+    long long int records = 0;
+    std::chrono::nanoseconds time = std::chrono::nanoseconds::zero();
+    std::chrono::nanoseconds time_max = std::chrono::nanoseconds::zero();
+private:
+    std::string _name;
+    std::shared_ptr<StatCounters> _cnt;
+};
+
+class Compress : public FilterBase {
+public:
+    Compress():FilterBase("compress"),_stat(std::make_shared<CodecStat>("compress",cnt)) {}
+#ifdef  YAML_CONFIG
+    auto init_yaml(YAML::Node cfg) -> error_c override {
+        if (cfg["keyframe"]) _keyframe = cfg["keyframe"].as<int>();
+        return error_c();
+    }
+#endif  //YAML_CONFIG
+    auto stat() -> std::shared_ptr<Stat> override {
+        return _stat;
+    }
+
+    auto write(const void* buf, int len) -> int override {
+        auto start = std::chrono::steady_clock::now();
+        auto* data = static_cast<const uint8_t*>(buf);
+        if (len > 0xFFFF) {
+            write_rest(buf,len);
+            return len;
+        }
+        uint32_t key = delta::key(data,len);
+        auto& slot = _slots[delta::slot(key)];
+        bool delta = slot.valid && slot.key==key && int(slot.data.size())==len && slot.count<_keyframe;
+        _frame.resize(delta::HEADER+len+delta::CRC);
+        int size = delta ? encode(data, slot.data.data(), len, _frame.data()+delta::HEADER) : -1;
+        if (size<0) {
+            delta = false;
+            size = len;
+            std::memcpy(_frame.data()+delta::HEADER, data, len);
+        }
+        slot.key = key;
+        slot.seq++;
+        slot.valid = true;
+        slot.count = delta ? slot.count+1 : 0;
+        slot.data.assign(data, data+len);
+        _frame[0] = delta::MAGIC;
+        _frame[1] = delta ? delta::DELTA : delta::LITERAL;
+        _frame[2] = delta::slot(key);
+        _frame[3] = slot.seq;
+        _frame[4] = size >> 8;
+        _frame[5] = size & 0xFF;
+        uint16_t crc = crc_calculate(_frame.data()+1, delta::HEADER-1+size);
+        _frame[delta::HEADER+size] = crc & 0xFF;
+        _frame[delta::HEADER+size+1] = crc >> 8;
+        int frame_len = delta::HEADER+size+delta::CRC;
+        _stat->add(len, frame_len, std::chrono::steady_clock::now()-start);
+        write_next(_frame.data(), frame_len);
+        return len;
+    }
+
+private:
+    // XOR against reference with zero runs packed as 0x00,count.
+    // Returns -1 when the result is not shorter than the record
+    static auto encode(const uint8_t* data, const uint8_t* ref, int len, uint8_t* out) -> int {
+        int o = 0;
+        for (int i=0;i<len;) {
+            uint8_t b = data[i] ^ ref[i];
+            if (b) {
+                out[o++] = b;
+                i++;
+            } else {
+                int run = 1;
+                while (i+run<len && run<255 && data[i+run]==ref[i+run]) run++;
+                if (o+2 > len-1) return -1;
+                out[o++] = 0;
+                out[o++] = run;
+                i += run;
+            }
+            if (o >= len) return -1;
+        }
+        return o;
+    }
+
+    int _keyframe = 20;
+    std::array<delta::Slot,256> _slots;
+    std::vector<uint8_t> _frame;
+    std::shared_ptr<CodecStat> _stat;
+};
+
+class Decompress : public FilterBase {
+public:
+    Decompress():FilterBase("decompress"),_stat(std::make_shared<CodecStat>("decompress",cnt)) {}
+#ifdef  YAML_CONFIG
+    auto init_yaml(YAML::Node cfg) -> error_c override {
+        return error_c();
+    }
+#endif  //YAML_CONFIG
+    auto stat() -> std::shared_ptr<Stat> override {
+        return _stat;
+    }
+
+    auto write(const void* buf, int len) -> int override {
+        auto* data = static_cast<const uint8_t*>(buf);
+        if (_input.empty()) {
+            // datagrams usually carry whole frames, parse them in place
+            int used = parse(data, len);
+            if (used<len) _input.assign(data+used, data+len);
+            return len;
+        }
+        _input.insert(_input.end(), data, data+len);
+        int used = parse(_input.data(), _input.size());
+        _input.erase(_input.begin(), _input.begin()+used);
+        return len;
+    }
+
+private:
+    // returns number of processed bytes
+    auto parse(const uint8_t* data, int len) -> int {
+        int pos = 0;
+        while (pos<len) {
+            if (data[pos]!=delta::MAGIC) {
+                auto* magic = static_cast<const uint8_t*>(memchr(data+pos, delta::MAGIC, len-pos));
+                int skip = magic ? magic-(data+pos) : len-pos;
+                write_rest(data+pos, skip);
+                pos += skip;
+                continue;
+            }
+            if (len-pos < delta::HEADER) break;
+            const uint8_t* frame = data+pos;
+            int size = (frame[4]<<8) | frame[5];
+            if (frame[1]>delta::DELTA) {
+                cnt->add("badframe",1);
+                write_rest(frame,1);
+                pos++;
+                continue;
+            }
+            if (len-pos < delta::HEADER+size+delta::CRC) break;
+            uint16_t crc = crc_calculate(frame+1, delta::HEADER-1+size);
+            if ((frame[delta::HEADER+size] | (frame[delta::HEADER+size+1]<<8)) != crc) {
+                cnt->add("badcrc",1);
+                write_rest(frame,1);
+                pos++;
+                continue;
+            }
+            pos += delta::HEADER+size+delta::CRC;
+            record(frame, size);
+        }
+        return pos;
+    }
+
+    void record(const uint8_t* frame, int size) {
+        auto start = std::chrono::steady_clock::now();
+        auto& slot = _slots[frame[2]];
+        uint8_t seq = frame[3];
+        const uint8_t* payload = frame+delta::HEADER;
+        if (frame[1]==delta::LITERAL) {
+            slot.data.assign(payload, payload+size);
+        } else {
+            if (!slot.valid || uint8_t(slot.seq+1)!=seq) {
+                // reference record was lost, wait for the next literal
+                slot.valid = false;
+                cnt->add("desync",1);
+                return;
+            }
+            if (!decode(payload, size, slot.data)) {
+                slot.valid = false;
+                cnt->add("badframe",1);
+                return;
+            }
+        }
+        slot.seq = seq;
+        slot.valid = true;
+        _stat->add(slot.data.size(), delta::HEADER+size+delta::CRC, std::chrono::steady_clock::now()-start);
+        write_next(slot.data.data(), slot.data.size());
+    }
+
+    static auto decode(const uint8_t* in, int size, std::vector<uint8_t>& data) -> bool {
+        int len = data.size();
+        int o = 0;
+        for (int i=0;i<size;i++) {
+            if (in[i]) {
+                if (o>=len) return false;
+                data[o++] ^= in[i];
+            } else {
+                if (++i>=size) return false;
+                o += in[i];
+                if (o>len) return false;
+            }
+        }
+        return o==len;
+    }
+
+    std::array<delta::Slot,256> _slots;
+    std::vector<uint8_t> _input;
+    std::shared_ptr<CodecStat> _stat;
+};
+
+#endif  //!__COMPRESS__H__
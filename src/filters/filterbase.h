@@ -4,21 +4,26 @@
 #include "../impl/statobj.h"
 class FilterBase : public Filter {
 public:
-    FilterBase(std::string name):cnt(std::make_shared<StatCounters>(std::move(name))) {}
+    FilterBase(std::string name):cnt(std::make_shared<FrameCounters>(std::move(name))),
+        cnt_next(cnt->handle("next")),cnt_pack(cnt->handle("pack")),cnt_rest(cnt->handle("rest")) {}
     auto stat() -> std::shared_ptr<Stat> override {
         return cnt;
     }
     auto write_next(const void* buf, int len) -> int override {
-        cnt->add("next", len);
-        cnt->add("pack", 1);
+        cnt->add(cnt_next, len);
+        cnt->add(cnt_pack, 1);
+        cnt->frame(len);
         return Filter::write_next(buf, len);
     }
     auto write_rest(const void* buf, int len) -> int override {
-        cnt->add("rest", len);
+        cnt->add(cnt_rest, len);
         return Filter::write_rest(buf, len);
     }
 protected:
-    std::shared_ptr<StatCounters> cnt;
+    std::shared_ptr<FrameCounters> cnt;
+    StatCounters::Handle cnt_next;
+    StatCounters::Handle cnt_pack;
+    StatCounters::Handle cnt_rest;
     int packet_len = 0;
 };
 #endif  //!__FILTERBASE__H__
\ No newline at end of file
@@ -4,6 +4,8 @@
 #include "../log.h"
 #include <cstdint>
 #include <cstring>
+#include <algorithm>
+#include <array>
 #include <memory>
 #include <set>
 #include <map>
@@ -57,10 +59,145 @@ std::array<uint8_t,256> crc_extra =
                          49,  170, 44,  83,  46,   0};
 
 
+// Per msgid traffic accounting: packets, bytes and frames with bad crc
+// in flat arrays indexed by msgid, optionally the same per sysid, and
+// packets lost by sequence gaps. Report has totals and top N messages
+// (and systems) by bytes in the period with their packet rate. Exposition
+// has all of them as msg_* and sys_* families with msgid and sysid labels.
+class MavlinkStat : public Stat {
+public:
+    MavlinkStat(std::shared_ptr<FrameCounters> cnt, int top, bool sysid):_cnt(std::move(cnt)),_top(top),_sysid(sysid),_last(Clock::now()) {
+        for(int i=0;i<256;i++) {
+            auto id = std::to_string(i);
+            _msg_fields[i] = {"msg"+id+"_pkts","msg"+id+"_bytes","msg"+id+"_rate","msg"+id+"_badcrc"};
+            _msg_labels[i] = "msgid=\""+id+'"';
+            if (_sysid) {
+                _sys_fields[i] = {"sys"+id+"_pkts","sys"+id+"_bytes","sys"+id+"_rate","sys"+id+"_lost"};
+                _sys_labels[i] = "sysid=\""+id+'"';
+            }
+        }
+    }
+    void packet(const uint8_t* packet, int len) {
+        uint8_t msgid = packet[5];
+        _msg[msgid].pkts++;
+        _msg[msgid].bytes += len;
+        uint8_t sysid = packet[3];
+        auto& seq = _seq[uint8_t(sysid ^ packet[4]*31)];
+        uint16_t key = sysid | (packet[4]<<8);
+        int lost = 0;
+        if (seq.valid && seq.key==key) {
+            lost = uint8_t(packet[2]-seq.seq-1);
+            if (lost>128) lost = 0; // reordered or duplicated
+            _lost += lost;
+        }
+        seq = {key, packet[2], true};
+        if (_sysid) {
+            _sys[sysid].pkts++;
+            _sys[sysid].bytes += len;
+            _sys[sysid].drops += lost;
+        }
+    }
+    void badcrc(const uint8_t* packet) {
+        _msg[packet[5]].drops++;
+    }
+    void report(OStat& out) override {
+        auto now = Clock::now();
+        double period = std::chrono::duration<double>(now-_last).count();
+        _last = now;
+        auto& meter = metric(_cnt->name());
+        long long pkts = 0;
+        long long bytes = 0;
+        for(auto& m : _msg) {
+            pkts += m.pkts;
+            bytes += m.bytes;
+        }
+        meter.add_field("pkts", pkts);
+        meter.add_field("bytes", bytes);
+        meter.add_field("lost", _lost);
+        report_top(meter, _msg, _msg_fields, period);
+        if (_sysid) report_top(meter, _sys, _sys_fields, period);
+        _cnt->report(meter);
+        out.send(meter);
+    }
+    void expose(OExpose& out) override {
+        _cnt->expose(out);
+        for(int i=0;i<256;i++) {
+            if (!_msg[i].pkts && !_msg[i].drops) continue;
+            out.counter(_cnt->name(), "msg_pkts", labels(), _msg_labels[i], _msg[i].pkts);
+            out.counter(_cnt->name(), "msg_bytes", labels(), _msg_labels[i], _msg[i].bytes);
+            out.counter(_cnt->name(), "msg_badcrc", labels(), _msg_labels[i], _msg[i].drops);
+        }
+        for(int i=0;_sysid && i<256;i++) {
+            if (!_sys[i].pkts) continue;
+            out.counter(_cnt->name(), "sys_pkts", labels(), _sys_labels[i], _sys[i].pkts);
+            out.counter(_cnt->name(), "sys_bytes", labels(), _sys_labels[i], _sys[i].bytes);
+            out.counter(_cnt->name(), "sys_lost", labels(), _sys_labels[i], _sys[i].drops);
+        }
+        out.counter(_cnt->name(), "lost", labels(), _lost);
+    }
+    void share(std::shared_ptr<StatShare> shm) override {
+        _cnt->set_tags(tags());
+        _cnt->share(std::move(shm));
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+    struct Entry {
+        int64_t pkts = 0;
+        int64_t bytes = 0;
+        int64_t drops = 0;
+        int64_t reported_pkts = 0;
+        int64_t reported_bytes = 0;
+    };
+    struct Seq {
+        uint16_t key = 0;
+        uint8_t seq = 0;
+        bool valid = false;
+    };
+    using Fields = std::array<std::string,4>;
+    void report_top(Metric& meter, std::array<Entry,256>& entries, std::array<Fields,256>& fields, double period) {
+        int n = 0;
+        for(int i=0;i<256;i++) {
+            if (entries[i].bytes!=entries[i].reported_bytes) _order[n++] = i;
+        }
+        int top = std::min(n,_top);
+        std::partial_sort(_order.begin(), _order.begin()+top, _order.begin()+n, [&entries](uint8_t a, uint8_t b){
+            return entries[a].bytes-entries[a].reported_bytes > entries[b].bytes-entries[b].reported_bytes;
+        });
+        for(int i=0;i<top;i++) {
+            auto& e = entries[_order[i]];
+            auto& f = fields[_order[i]];
+            int64_t pkts = e.pkts-e.reported_pkts;
+            meter.add_field(f[0], pkts);
+            meter.add_field(f[1], e.bytes-e.reported_bytes);
+            if (period>0) meter.add_field(f[2], pkts/period);
+            if (e.drops) meter.add_field(f[3], e.drops);
+        }
+        for(auto& e : entries) {
+            e.reported_pkts = e.pkts;
+            e.reported_bytes = e.bytes;
+        }
+    }
+
+    std::shared_ptr<FrameCounters> _cnt;
+    int _top;
+    bool _sysid;
+    Clock::time_point _last;
+    int64_t _lost = 0;
+    std::array<Entry,256> _msg;
+    std::array<Entry,256> _sys;
+    std::array<Seq,256> _seq;
+    std::array<uint8_t,256> _order;
+    std::array<Fields,256> _msg_fields;
+    std::array<Fields,256> _sys_fields;
+    std::array<std::string,256> _msg_labels; // exposition label of msgid
+    std::array<std::string,256> _sys_labels;
+};
+
 class Mavlink_v1 : public FilterBase {
 public:
     enum {STX=0xFE};
-    Mavlink_v1(uint8_t* crc_array=crc_extra.data()):FilterBase("mavlink_v1"),_crc_extra(crc_array) {}
+    Mavlink_v1(uint8_t* crc_array=crc_extra.data()):FilterBase("mavlink_v1"),_crc_extra(crc_array),_cnt_badcrc(cnt->handle("badcrc")) {}
 #ifdef  YAML_CONFIG
     auto init_yaml(YAML::Node cfg) -> error_c override {
         auto crcs = cfg["crc_extra"];
@@ -79,9 +216,25 @@ public:
         }
         if (!_crc_extra) { _crc_extra = crc_extra.data();
         }
+        auto accounting = cfg["accounting"];
+        if (accounting) {
+            int top = 10;
+            bool sysid = false;
+            if (accounting.IsMap()) {
+                if (accounting["top"]) top = accounting["top"].as<int>();
+                if (accounting["sysid"]) sysid = accounting["sysid"].as<bool>();
+            } else if (!accounting.as<bool>()) {
+                return error_c();
+            }
+            _accounting = std::make_shared<MavlinkStat>(cnt, top, sysid);
+        }
         return error_c();
     }
 #endif  //YAML_CONFIG
+    auto stat() -> std::shared_ptr<Stat> override {
+        if (_accounting) return _accounting;
+        return cnt;
+    }
     auto write(const void* buf, int len) -> int override {
         auto* ptr = (uint8_t*)buf;
         auto ret = len;
@@ -122,10 +275,12 @@ public:
                     if (packet_len==size) {
                         state = BEFORE;
                         if (valid_checksum()) {
+                            if (_accounting) _accounting->packet(packet.data(),packet_len);
                             write_next(packet.data(),packet_len);
                             break;
                         }
-                        cnt->add("badcrc",1);
+                        if (_accounting) _accounting->badcrc(packet.data());
+                        cnt->add(_cnt_badcrc,1);
                         write_rest(packet.data(),1);
                         write(packet.data()+1,packet_len-1);
                     }
@@ -143,6 +298,8 @@ public:
 private:
     std::array<uint8_t,263> packet;
     uint8_t* _crc_extra = nullptr;
+    StatCounters::Handle _cnt_badcrc;
+    std::shared_ptr<MavlinkStat> _accounting;
     std::vector<uint8_t> crc_holder;
     enum State {BEFORE,LEN, LOAD};
     State state = BEFORE;
@@ -0,0 +1,199 @@
+#ifndef __BPF__H__
+#define __BPF__H__
+#include <arpa/inet.h>
+#include <linux/filter.h>
+#include <sys/socket.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../err.h"
+
+// Classic BPF program for datagram sockets built from predicates.
+// All predicates have to match, values in one predicate are alternatives.
+// The kernel runs the program on every datagram before it is queued to the
+// socket, rejected ones never wake the loop. Offsets are in the payload,
+// the program of UDP socket sees the 8 bytes of UDP header first.
+// A coalesced GRO datagram would be checked as one, so sockets with a
+// filter don't enable GRO.
+class BpfFilter {
+public:
+    struct Net {
+        uint32_t addr; // host order
+        uint32_t mask;
+    };
+    struct Bytes {
+        uint32_t offset;
+        int width = 1; // 1, 2 or 4 bytes, network order
+        uint32_t mask = 0;
+        std::vector<uint32_t> values;
+    };
+
+    auto empty() const -> bool { return !_min && !_max && _nets.empty() && _bytes.empty();
+    }
+    void size(uint32_t min, uint32_t max) {
+        _min = min;
+        _max = max;
+    }
+    // ipv4 source addresses allowed
+    void source(uint32_t addr, uint32_t mask) {
+        _nets.push_back({addr & mask, mask});
+    }
+    void bytes(Bytes b) {
+        _bytes.push_back(std::move(b));
+    }
+#ifdef YAML_CONFIG
+    auto init_yaml(YAML::Node cfg) -> error_c;
+#endif
+    auto compile(std::vector<sock_filter>& code) const -> error_c;
+    // applies to datagrams queued after the call, so set before bind
+    auto attach(int fd, int family) const -> error_c {
+        if (empty()) return error_c();
+        if (!_nets.empty() && family!=AF_INET) return errno_c(EAFNOSUPPORT,"bpf source filter");
+        std::vector<sock_filter> code;
+        error_c ret = compile(code);
+        if (ret) return ret;
+        sock_fprog prog{static_cast<unsigned short>(code.size()), code.data()};
+        return to_errno_c(setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)),"attach filter");
+    }
+
+private:
+    static constexpr uint32_t udp_header = 8;
+    static constexpr uint32_t ip_source = 12; // offset in ipv4 header
+    static constexpr uint16_t REJECT = 0xffff;  // jump target placeholders
+    static constexpr uint16_t NEXT = 0xfffe;    // end of current predicate
+
+    uint32_t _min = 0;
+    uint32_t _max = 0;
+    std::vector<Net> _nets;
+    std::vector<Bytes> _bytes;
+};
+
+inline auto BpfFilter::compile(std::vector<sock_filter>& code) const -> error_c {
+    // jump offsets of classic BPF are relative and 8 bit, targets are
+    // emitted as placeholders and resolved at the end
+    struct Insn {
+        uint16_t code;
+        uint16_t jt, jf; // absolute index or placeholder
+        uint32_t k;
+    };
+    std::vector<Insn> prog;
+    auto here = [&prog]() -> uint16_t { return prog.size(); };
+    auto close = [&prog, &here]() {
+        for(auto& insn : prog) {
+            if (insn.jt==NEXT) insn.jt = here();
+            if (insn.jf==NEXT) insn.jf = here();
+        }
+    };
+    auto next = [&here]() -> uint16_t { return here()+1; };
+
+    if (_min || _max) {
+        prog.push_back({BPF_LD | BPF_W | BPF_LEN, 0, 0, 0});
+        if (_min) prog.push_back({BPF_JMP | BPF_JGE | BPF_K, next(), REJECT, _min+udp_header});
+        if (_max) prog.push_back({BPF_JMP | BPF_JGT | BPF_K, REJECT, next(), _max+udp_header});
+    }
+    if (!_nets.empty()) {
+        for(auto& net : _nets) {
+            prog.push_back({BPF_LD | BPF_W | BPF_ABS, 0, 0, uint32_t(SKF_NET_OFF)+ip_source});
+            if (net.mask!=0xffffffff) prog.push_back({BPF_ALU | BPF_AND | BPF_K, 0, 0, net.mask});
+            prog.push_back({BPF_JMP | BPF_JEQ | BPF_K, NEXT, next(), net.addr});
+        }
+        prog.push_back({BPF_JMP | BPF_JA, REJECT, REJECT, 0});
+        close();
+    }
+    for(auto& b : _bytes) {
+        uint16_t size = b.width==4 ? BPF_W : b.width==2 ? BPF_H : BPF_B;
+        prog.push_back({uint16_t(BPF_LD | size | BPF_ABS), 0, 0, b.offset+udp_header});
+        if (b.mask) prog.push_back({BPF_ALU | BPF_AND | BPF_K, 0, 0, b.mask});
+        for(auto value : b.values) {
+            prog.push_back({BPF_JMP | BPF_JEQ | BPF_K, NEXT, next(), value});
+        }
+        prog.push_back({BPF_JMP | BPF_JA, REJECT, REJECT, 0});
+        close();
+    }
+    uint16_t accept = here();
+    prog.push_back({BPF_RET | BPF_K, 0, 0, 0xffffffff});
+    uint16_t reject = here();
+    prog.push_back({BPF_RET | BPF_K, 0, 0, 0});
+    if (prog.size()>BPF_MAXINSNS) return errno_c(E2BIG,"bpf program");
+
+    code.clear();
+    for(uint16_t i=0;i<prog.size();i++) {
+        auto& insn = prog[i];
+        auto target = [&](uint16_t t) { return t==REJECT ? reject : t==NEXT ? accept : t; };
+        sock_filter f{insn.code, 0, 0, insn.k};
+        if (BPF_CLASS(insn.code)==BPF_JMP) {
+            if (BPF_OP(insn.code)==BPF_JA) {
+                f.k = target(insn.jt)-i-1;
+            } else {
+                int jt = target(insn.jt)-i-1;
+                int jf = target(insn.jf)-i-1;
+                if (jt>255 || jf>255) return errno_c(E2BIG,"bpf jump");
+                f.jt = jt;
+                f.jf = jf;
+            }
+        }
+        code.push_back(f);
+    }
+    return error_c();
+}
+
+#ifdef YAML_CONFIG
+// accept:
+//   size: {min: 8, max: 280}      # payload length
+//   source: [192.168.1.0/24, 10.0.0.5]
+//   bytes:
+//     - {offset: 0, value: [0xFE, 0xFD]}
+//     - {offset: 3, value: 1, mask: 0xFF, width: 1}
+inline auto BpfFilter::init_yaml(YAML::Node cfg) -> error_c {
+    if (!cfg) return error_c();
+    if (!cfg.IsMap()) return errno_c(EINVAL,"filter");
+    auto sz = cfg["size"];
+    if (sz) {
+        if (sz["min"]) _min = sz["min"].as<uint32_t>();
+        if (sz["max"]) _max = sz["max"].as<uint32_t>();
+        if (_max && _min>_max) return errno_c(EINVAL,"filter size");
+    }
+    auto src = cfg["source"];
+    if (src) {
+        std::vector<std::string> nets;
+        if (src.IsScalar()) { nets.push_back(src.as<std::string>());
+        } else {
+            for(auto n : src) nets.push_back(n.as<std::string>());
+        }
+        for(auto& n : nets) {
+            auto slash = n.find('/');
+            int bits = 32;
+            if (slash!=std::string::npos) bits = std::stoi(n.substr(slash+1));
+            in_addr addr;
+            if (bits<0 || bits>32 || inet_pton(AF_INET, n.substr(0,slash).c_str(), &addr)!=1) {
+                return errno_c(EINVAL,"filter source "+n);
+            }
+            source(ntohl(addr.s_addr), bits ? 0xffffffff << (32-bits) : 0);
+        }
+    }
+    auto bts = cfg["bytes"];
+    if (bts) {
+        if (!bts.IsSequence()) return errno_c(EINVAL,"filter bytes");
+        for(auto b : bts) {
+            Bytes item;
+            if (!b["offset"] || !b["value"]) return errno_c(EINVAL,"filter bytes offset and value");
+            item.offset = b["offset"].as<uint32_t>();
+            if (b["width"]) item.width = b["width"].as<int>();
+            if (item.width!=1 && item.width!=2 && item.width!=4) return errno_c(EINVAL,"filter bytes width");
+            if (b["mask"]) item.mask = b["mask"].as<uint32_t>();
+            auto value = b["value"];
+            if (value.IsScalar()) { item.values.push_back(value.as<uint32_t>());
+            } else {
+                for(auto v : value) item.values.push_back(v.as<uint32_t>());
+            }
+            if (item.values.empty()) return errno_c(EINVAL,"filter bytes value");
+            bytes(std::move(item));
+        }
+    }
+    return error_c();
+}
+#endif //YAML_CONFIG
+
+#endif  //!__BPF__H__
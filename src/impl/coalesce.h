@@ -0,0 +1,79 @@
+#ifndef __COALESCE__H__
+#define __COALESCE__H__
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+using namespace std::chrono_literals;
+
+#include "../inc/timer.h"
+
+struct CoalesceParams {
+    int mtu = 0; // 0 - coalescing disabled
+    std::chrono::nanoseconds deadline = 2ms;
+#ifdef YAML_CONFIG
+    void init_yaml(YAML::Node cfg);
+#endif //YAML_CONFIG
+};
+
+// Packs whole frames into one datagram up to mtu bytes.
+// Datagram is sent when the next frame doesn't fit or when the deadline
+// after the first queued frame expires. Frames are never split.
+class Coalescer {
+public:
+    using SendFunc = std::function<int(const void*, int)>;
+    Coalescer(const CoalesceParams& params, std::unique_ptr<Timer> timer, SendFunc send):
+        _mtu(params.mtu), _deadline(params.deadline), _timer(std::move(timer)), _send(std::move(send)) {
+        _buffer.reserve(_mtu);
+        _timer->shoot([this](){ flush(); });
+    }
+    ~Coalescer() { flush();
+    }
+    auto write(const void* buf, int len) -> int {
+        if (len > _mtu) {
+            flush();
+            return _send(buf, len);
+        }
+        if (int(_buffer.size()) + len > _mtu) flush();
+        if (_buffer.empty()) {
+            error_c ec = _timer->arm_oneshoot(_deadline);
+            if (ec) {
+                _timer->on_error(ec);
+                return _send(buf, len);
+            }
+        }
+        const auto* ptr = static_cast<const uint8_t*>(buf);
+        _buffer.insert(_buffer.end(), ptr, ptr+len);
+        if (int(_buffer.size()) == _mtu) flush();
+        return len;
+    }
+    void flush() {
+        if (_buffer.empty()) return;
+        _send(_buffer.data(), _buffer.size());
+        _buffer.clear();
+    }
+private:
+    int _mtu;
+    std::chrono::nanoseconds _deadline;
+    std::unique_ptr<Timer> _timer;
+    SendFunc _send;
+    std::vector<uint8_t> _buffer;
+};
+
+#ifdef YAML_CONFIG
+#include "yaml.h"
+inline void CoalesceParams::init_yaml(YAML::Node cfg) {
+    if (!cfg) return;
+    if (cfg.IsScalar()) {
+        if (cfg.as<bool>()) mtu = 1400;
+        return;
+    }
+    if (!cfg.IsMap()) return;
+    mtu = 1400;
+    if (cfg["mtu"]) mtu = cfg["mtu"].as<int>();
+    auto d = duration(cfg["deadline"]);
+    if (d.count()) deadline = d;
+}
+#endif //YAML_CONFIG
+
+#endif  //!__COALESCE__H__
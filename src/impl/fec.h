@@ -0,0 +1,416 @@
+#ifndef __FEC__H__
+#define __FEC__H__
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+using namespace std::chrono_literals;
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "../inc/timer.h"
+#include "statobj.h"
+
+// Systematic forward error correction over groups of datagrams.
+// Every group carries k data datagrams as is (with a header) and n-k parity
+// datagrams. Any k of n datagrams of a group restore the whole group.
+// Parity rows are Cauchy matrix rows over GF(2^8) scaled so the first parity
+// row is all ones: n-k=1 is plain XOR, more parity is Reed-Solomon.
+//
+// Header: magic, k, n, index, group (16 bit, big endian).
+// Data payload is prefixed by its 16 bit length inside the parity
+// calculation, so recovered datagrams get their original size back.
+
+struct FecParams {
+    int k = 0; // 0 - FEC disabled
+    int n = 0;
+    std::chrono::nanoseconds timeout = 20ms; // close incomplete group
+#ifdef YAML_CONFIG
+    auto init_yaml(YAML::Node cfg) -> error_c;
+#endif //YAML_CONFIG
+};
+
+namespace fec {
+
+constexpr uint8_t MAGIC = 0xFE;
+constexpr int HEADER = 6;
+constexpr int MAX_N = 64;
+
+class GF256 {
+public:
+    GF256() {
+        int x = 1;
+        for (int i=0;i<255;i++) {
+            _exp[i] = _exp[i+255] = x;
+            _log[x] = i;
+            x <<= 1;
+            if (x & 0x100) x ^= 0x11d;
+        }
+    }
+    auto mul(uint8_t a, uint8_t b) const -> uint8_t {
+        if (a==0 || b==0) return 0;
+        return _exp[_log[a]+_log[b]];
+    }
+    auto inv(uint8_t a) const -> uint8_t { return _exp[255-_log[a]];
+    }
+    auto div(uint8_t a, uint8_t b) const -> uint8_t {
+        if (a==0) return 0;
+        return _exp[_log[a]+255-_log[b]];
+    }
+    // parity row p, column j coefficient
+    auto coef(int p, int j) const -> uint8_t {
+        if (p==0) return 1;
+        // Cauchy 1/(x_p+y_j) with x_p = 255-p, y_j = j, column scaled by row 0
+        return div(inv(uint8_t(255-p) ^ uint8_t(j)), inv(255 ^ uint8_t(j)));
+    }
+    static auto get() -> const GF256& {
+        static const GF256 gf;
+        return gf;
+    }
+private:
+    std::array<uint8_t,512> _exp;
+    std::array<int,256> _log;
+};
+
+inline void xor_region(uint8_t* dst, const uint8_t* src, int len) {
+    int i = 0;
+#if defined(__aarch64__)
+    for (;i+16<=len;i+=16) {
+        vst1q_u8(dst+i, veorq_u8(vld1q_u8(dst+i), vld1q_u8(src+i)));
+    }
+#elif defined(__SSE2__)
+    for (;i+16<=len;i+=16) {
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst+i));
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src+i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+i), _mm_xor_si128(d,s));
+    }
+#endif
+    for (;i<len;i++) dst[i] ^= src[i];
+}
+
+// dst ^= c*src, table lookups by nibbles are done with vector shuffles
+inline void muladd_region(uint8_t* dst, const uint8_t* src, uint8_t c, int len) {
+    if (c==0) return;
+    if (c==1) { xor_region(dst,src,len); return;
+    }
+    auto& gf = GF256::get();
+    uint8_t lo[16], hi[16];
+    for (int x=0;x<16;x++) {
+        lo[x] = gf.mul(c,x);
+        hi[x] = gf.mul(c,x<<4);
+    }
+    int i = 0;
+#if defined(__aarch64__)
+    uint8x16_t tlo = vld1q_u8(lo);
+    uint8x16_t thi = vld1q_u8(hi);
+    uint8x16_t mask = vdupq_n_u8(0x0f);
+    for (;i+16<=len;i+=16) {
+        uint8x16_t s = vld1q_u8(src+i);
+        uint8x16_t p = veorq_u8(vqtbl1q_u8(tlo, vandq_u8(s,mask)), vqtbl1q_u8(thi, vshrq_n_u8(s,4)));
+        vst1q_u8(dst+i, veorq_u8(vld1q_u8(dst+i), p));
+    }
+#elif defined(__SSSE3__)
+    __m128i tlo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lo));
+    __m128i thi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hi));
+    __m128i mask = _mm_set1_epi8(0x0f);
+    for (;i+16<=len;i+=16) {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src+i));
+        __m128i p = _mm_xor_si128(_mm_shuffle_epi8(tlo, _mm_and_si128(s,mask)),
+                                  _mm_shuffle_epi8(thi, _mm_and_si128(_mm_srli_epi64(s,4),mask)));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst+i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+i), _mm_xor_si128(d,p));
+    }
+#endif
+    for (;i<len;i++) dst[i] ^= lo[src[i] & 0x0f] ^ hi[src[i] >> 4];
+}
+
+inline void header(uint8_t* buf, int k, int n, int index, uint16_t group) {
+    buf[0] = MAGIC;
+    buf[1] = k;
+    buf[2] = n;
+    buf[3] = index;
+    buf[4] = group >> 8;
+    buf[5] = group & 0xFF;
+}
+
+} // namespace fec
+
+class FecEncoder {
+public:
+    using SendFunc = std::function<int(const void*, int)>;
+    FecEncoder(const FecParams& params, std::unique_ptr<Timer> timer, SendFunc send, std::shared_ptr<StatCounters> cnt):
+        _k(params.k), _n(params.n), _timeout(params.timeout), _timer(std::move(timer)), _send(std::move(send)), _cnt(std::move(cnt)) {
+        _shards.resize(_k);
+        _cnt_parity = _cnt->handle("fec_parity");
+        _timer->shoot([this](){ flush(); });
+    }
+    ~FecEncoder() { flush();
+    }
+    auto write(const void* buf, int len) -> int {
+        if (len > 0xFFFF) return -1;
+        _out.resize(fec::HEADER+len);
+        fec::header(_out.data(), _k, _n, _idx, _group);
+        std::memcpy(_out.data()+fec::HEADER, buf, len);
+        int ret = _send(_out.data(), _out.size());
+        auto& shard = _shards[_idx];
+        shard.resize(2+len);
+        shard[0] = len >> 8;
+        shard[1] = len & 0xFF;
+        std::memcpy(shard.data()+2, buf, len);
+        if (_idx++ == 0 && _n > _k) {
+            error_c ec = _timer->arm_oneshoot(_timeout);
+            if (ec) _timer->on_error(ec);
+        }
+        if (_idx == _k) flush();
+        return ret < 0 ? ret : len;
+    }
+    // sends parity of the current group, incomplete group is sent with k reduced
+    void flush() {
+        if (_idx==0) return;
+        int k = _idx;
+        int parity = _n - _k;
+        size_t size = 0;
+        for (int j=0;j<k;j++) size = std::max(size,_shards[j].size());
+        auto& gf = fec::GF256::get();
+        for (int p=0;p<parity;p++) {
+            _out.assign(fec::HEADER+size, 0);
+            fec::header(_out.data(), k, k+parity, k+p, _group);
+            for (int j=0;j<k;j++) {
+                fec::muladd_region(_out.data()+fec::HEADER, _shards[j].data(), gf.coef(p,j), _shards[j].size());
+            }
+            int ret = _send(_out.data(), _out.size());
+            if (ret > 0) _cnt->add(_cnt_parity,ret);
+        }
+        _idx = 0;
+        _group++;
+    }
+private:
+    int _k;
+    int _n;
+    std::chrono::nanoseconds _timeout;
+    std::unique_ptr<Timer> _timer;
+    SendFunc _send;
+    std::shared_ptr<StatCounters> _cnt;
+    StatCounters::Handle _cnt_parity;
+    int _idx = 0;
+    uint16_t _group = 0;
+    std::vector<std::vector<uint8_t>> _shards;
+    std::vector<uint8_t> _out;
+};
+
+// Delivers data datagrams as soon as they arrive, restores lost ones when
+// enough parity is received and drops duplicates.
+// Groups are kept in a small window; a group leaving the window accounts
+// its unrestored datagrams as lost. A group id far from the newest one
+// (the sender restarted its counter) starts the window anew, data of a
+// group older than the window is delivered without duplicate check.
+class FecDecoder {
+public:
+    using DeliverFunc = std::function<void(void*, int)>;
+    FecDecoder(std::shared_ptr<StatCounters> cnt):_cnt(std::move(cnt)) {}
+    ~FecDecoder() {
+        for (auto& g: _groups) release(g);
+    }
+
+    void read(void* buf, int len, const DeliverFunc& deliver) {
+        auto* data = static_cast<uint8_t*>(buf);
+        if (len < fec::HEADER || data[0]!=fec::MAGIC) {
+            _cnt->add("fec_badframe",1);
+            return;
+        }
+        int k = data[1];
+        int n = data[2];
+        int index = data[3];
+        uint16_t id = (data[4] << 8) | data[5];
+        if (k==0 || k>n || n>fec::MAX_N || index>=n) {
+            _cnt->add("fec_badframe",1);
+            return;
+        }
+        int16_t ahead = int16_t(id - _newest);
+        if (!_started || ahead > WINDOW || ahead < -WINDOW) {
+            if (_started) _cnt->add("fec_reset",1);
+            for (auto& g: _groups) {
+                release(g);
+                g.used = false;
+            }
+            _started = true;
+            _newest = id;
+        } else if (ahead > 0) {
+            _newest = id;
+        }
+        uint8_t* payload = data+fec::HEADER;
+        int size = len-fec::HEADER;
+        auto& g = _groups[id % WINDOW];
+        if (!g.used || g.id != id) {
+            if (g.used && int16_t(id - g.id) < 0) {
+                _cnt->add("fec_late",1);
+                if (index < k) deliver(payload, size);
+                return;
+            }
+            release(g);
+            g.used = true;
+            g.id = id;
+            g.k = 0;
+            g.last = -1;
+            g.data_mask = g.parity_mask = 0;
+            g.done = false;
+        }
+        if (index < k) {
+            if (g.data_mask & (1ull << index)) {
+                _cnt->add("fec_dup",1);
+                return;
+            }
+            g.data_mask |= 1ull << index;
+            g.last = std::max(g.last, index);
+            if (!g.done) {
+                auto& shard = g.shards[index];
+                shard.resize(2+size);
+                shard[0] = size >> 8;
+                shard[1] = size & 0xFF;
+                std::memcpy(shard.data()+2, payload, size);
+            }
+            deliver(payload, size);
+        } else {
+            if (g.done) return;
+            // parity carries the final k of the group
+            g.k = k;
+            g.parity_mask |= 1ull << (index-k);
+            g.shards[index].assign(payload, payload+size);
+        }
+        if (!g.done && g.k) {
+            int have = __builtin_popcountll(g.data_mask & mask(g.k));
+            if (have == g.k) {
+                g.done = true;
+            } else if (have + __builtin_popcountll(g.parity_mask) >= g.k) {
+                recover(g, deliver);
+            }
+        }
+    }
+
+private:
+    static constexpr int WINDOW = 16;
+    bool _started = false;
+    uint16_t _newest = 0; // the newest group id seen
+    struct Group {
+        bool used = false;
+        bool done = false;
+        uint16_t id = 0;
+        int k = 0;
+        int last = -1;
+        uint64_t data_mask = 0;
+        uint64_t parity_mask = 0;
+        std::array<std::vector<uint8_t>,fec::MAX_N> shards;
+    };
+
+    static auto mask(int k) -> uint64_t { return k>=64 ? ~0ull : (1ull << k) - 1;
+    }
+
+    void release(Group& g) {
+        if (!g.used || g.done) return;
+        int total = g.k ? g.k : g.last+1;
+        int lost = total - __builtin_popcountll(g.data_mask & mask(total));
+        if (lost > 0) _cnt->add("fec_lost",lost);
+    }
+
+    void recover(Group& g, const DeliverFunc& deliver) {
+        auto& gf = fec::GF256::get();
+        int k = g.k;
+        int missing[fec::MAX_N];
+        int parity[fec::MAX_N];
+        int m = 0;
+        for (int j=0;j<k;j++) {
+            if (!(g.data_mask & (1ull << j))) missing[m++] = j;
+        }
+        size_t size = 0;
+        for (int p=0, r=0; r<m; p++) {
+            if (g.parity_mask & (1ull << p)) {
+                parity[r++] = p;
+                size = std::max(size, g.shards[k+p].size());
+            }
+        }
+        // syndromes: parity minus known data contribution
+        for (int r=0;r<m;r++) {
+            auto& s = g.shards[k+parity[r]];
+            s.resize(size,0);
+            for (int j=0;j<k;j++) {
+                if (g.data_mask & (1ull << j)) {
+                    auto& d = g.shards[j];
+                    fec::muladd_region(s.data(), d.data(), gf.coef(parity[r],j), std::min(d.size(),size));
+                }
+            }
+        }
+        // invert m x m submatrix with Gauss-Jordan elimination
+        uint8_t a[fec::MAX_N][fec::MAX_N];
+        uint8_t inv[fec::MAX_N][fec::MAX_N];
+        for (int r=0;r<m;r++) {
+            for (int c=0;c<m;c++) {
+                a[r][c] = gf.coef(parity[r],missing[c]);
+                inv[r][c] = r==c;
+            }
+        }
+        for (int c=0;c<m;c++) {
+            int piv = c;
+            while (piv<m && a[piv][c]==0) piv++;
+            if (piv==m) return; // can't happen for Cauchy matrix
+            if (piv!=c) {
+                std::swap(a[piv],a[c]);
+                std::swap(inv[piv],inv[c]);
+            }
+            uint8_t f = gf.inv(a[c][c]);
+            for (int x=0;x<m;x++) {
+                a[c][x] = gf.mul(a[c][x],f);
+                inv[c][x] = gf.mul(inv[c][x],f);
+            }
+            for (int r=0;r<m;r++) {
+                if (r==c || a[r][c]==0) continue;
+                uint8_t e = a[r][c];
+                for (int x=0;x<m;x++) {
+                    a[r][x] ^= gf.mul(a[c][x],e);
+                    inv[r][x] ^= gf.mul(inv[c][x],e);
+                }
+            }
+        }
+        g.done = true;
+        for (int c=0;c<m;c++) {
+            auto& shard = g.shards[missing[c]];
+            shard.assign(size,0);
+            for (int r=0;r<m;r++) {
+                fec::muladd_region(shard.data(), g.shards[k+parity[r]].data(), inv[c][r], size);
+            }
+            g.data_mask |= 1ull << missing[c];
+            int len = (shard[0] << 8) | shard[1];
+            if (len+2 > int(size)) {
+                _cnt->add("fec_badframe",1);
+                continue;
+            }
+            _cnt->add("fec_recovered",1);
+            deliver(shard.data()+2, len);
+        }
+    }
+
+    std::shared_ptr<StatCounters> _cnt;
+    std::array<Group,WINDOW> _groups;
+};
+
+#ifdef YAML_CONFIG
+#include "yaml.h"
+inline auto FecParams::init_yaml(YAML::Node cfg) -> error_c {
+    if (!cfg || !cfg.IsMap()) return error_c();
+    if (!cfg["k"] || !cfg["n"]) return errno_c(EINVAL,"fec k and n");
+    k = cfg["k"].as<int>();
+    n = cfg["n"].as<int>();
+    if (k<1 || n<k || n>fec::MAX_N) return errno_c(EINVAL,"fec k and n");
+    auto t = duration(cfg["timeout"]);
+    if (t.count()) timeout = t;
+    return error_c();
+}
+#endif //YAML_CONFIG
+
+#endif  //!__FEC__H__
@@ -0,0 +1,121 @@
+#ifndef __GROUP__H__
+#define __GROUP__H__
+#include <sys/socket.h>
+
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "../err.h"
+#include "../log.h"
+#include "../loop.h"
+#include "../sockaddr.h"
+#include "peers.h"
+#include "statobj.h"
+
+// Sends the payload written to every peer of a server once.
+// Route writes the same frame to the peers one after another, the frame is
+// a duplicate if it equals the current one and the peer didn't get the
+// current one yet. Destinations are collected until the next frame comes or
+// the loop turn ends. If the frame went to every live peer and group address
+// (multicast or broadcast the peers listen to) is set, it is sent there once,
+// otherwise to the collected destinations by sendmmsg().
+class GroupSender : public error_handler {
+public:
+    // peers counts live peers of the server
+    GroupSender(int fd, IOLoopSvc* loop, std::shared_ptr<StatCounters> cnt, std::function<size_t()> peers):
+        _fd(fd),_loop(loop),_cnt(std::move(cnt)),_peers(std::move(peers)) {
+        _cnt_sent = _cnt->handle("group_sent");
+        _cnt_saved = _cnt->handle("group_saved");
+    }
+    ~GroupSender() { flush();
+    }
+    // the server socket is recreated on init
+    void fd(int fd) {
+        flush();
+        _fd = fd;
+    }
+    auto target(SockAddr addr) -> error_c {
+        int yes = 1;
+        error_c ret = to_errno_c(setsockopt(_fd, SOL_SOCKET, SO_BROADCAST, &yes, sizeof(yes)),"group broadcast");
+        if (ret) return ret;
+        _target = std::move(addr);
+        return error_c();
+    }
+    // gen is the last frame generation the peer got
+    auto write(uint32_t& gen, const PeerKey& addr, const void* buf, int len) -> int {
+        bool duplicate = gen!=_gen && len==int(_payload.size()) && std::memcmp(buf,_payload.data(),len)==0;
+        if (!duplicate) {
+            flush();
+            _gen++;
+            const auto* ptr = static_cast<const uint8_t*>(buf);
+            _payload.assign(ptr, ptr+len);
+        }
+        gen = _gen;
+        if (duplicate) _cnt->add(_cnt_saved,1);
+        if (!_scheduled) {
+            _scheduled = true;
+            std::weak_ptr<bool> alive = _alive;
+            _loop->defer([this, alive](){
+                if (alive.expired()) return;
+                _scheduled = false;
+                flush();
+            });
+        }
+        _queue.push_back(addr);
+        // the group decision needs all destinations of the frame
+        if (!_target.len() && _queue.size()==max_batch) flush();
+        return len;
+    }
+    void flush() {
+        if (_queue.empty()) return;
+        if (_target.len() && _queue.size()>=_peers()) {
+            if (sendto(_fd, _payload.data(), _payload.size(), 0, _target.sock_addr(), _target.len())==-1) {
+                errno_c err;
+                on_error(err, "group send");
+            } else _cnt->add(_cnt_sent,1);
+            _queue.clear();
+            return;
+        }
+        iovec iov{_payload.data(), _payload.size()};
+        _msgs.resize(_queue.size());
+        for(size_t i=0;i<_queue.size();i++) {
+            auto& hdr = _msgs[i].msg_hdr;
+            hdr = msghdr{};
+            hdr.msg_name = _queue[i].sock_addr();
+            hdr.msg_namelen = _queue[i].len;
+            hdr.msg_iov = &iov;
+            hdr.msg_iovlen = 1;
+        }
+        size_t pos = 0;
+        while (pos<_msgs.size()) {
+            int ret = sendmmsg(_fd, _msgs.data()+pos, _msgs.size()-pos, 0);
+            if (ret<=0) {
+                errno_c err;
+                on_error(err, "group sendmmsg");
+                pos++; // skip the failed destination
+                continue;
+            }
+            _cnt->add(_cnt_sent,ret);
+            pos += ret;
+        }
+        _queue.clear();
+    }
+private:
+    static constexpr size_t max_batch = 64;
+    int _fd;
+    IOLoopSvc* _loop;
+    std::shared_ptr<StatCounters> _cnt;
+    std::function<size_t()> _peers;
+    StatCounters::Handle _cnt_sent, _cnt_saved;
+    bool _scheduled = false; // flush is deferred to the end of the loop turn
+    std::shared_ptr<bool> _alive = std::make_shared<bool>(true); // for the deferred flush
+    SockAddr _target;
+    uint32_t _gen = 0;
+    std::vector<uint8_t> _payload;
+    std::vector<PeerKey> _queue;
+    std::vector<mmsghdr> _msgs;
+};
+
+#endif  //!__GROUP__H__
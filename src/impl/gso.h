@@ -0,0 +1,208 @@
+#ifndef __GSO__H__
+#define __GSO__H__
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+using namespace std::chrono_literals;
+
+#include "../log.h"
+#include "../inc/timer.h"
+
+// not defined by headers older than linux 4.18/5.0
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+struct GsoParams {
+    static constexpr int max_segments = 64;
+    int segments = 0; // datagrams in one send, 0 - segmentation offload disabled
+    std::chrono::nanoseconds deadline = 1ms;
+    bool gro = false; // receive coalesced datagrams
+#ifdef YAML_CONFIG
+    void init_yaml(YAML::Node cfg);
+#endif //YAML_CONFIG
+};
+
+// Datagram send with UDP_SEGMENT ancillary data, segment 0 sends the buffer
+// as one datagram. Address is null for connected socket.
+inline auto udp_send(int fd, sockaddr* addr, socklen_t addrlen, const void* buf, int len, uint16_t segment) -> int {
+    if (!segment) {
+        if (addr) return sendto(fd, buf, len, 0, addr, addrlen);
+        return send(fd, buf, len, 0);
+    }
+    iovec iov{const_cast<void*>(buf), size_t(len)};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(uint16_t))] = {};
+    msghdr msg{};
+    msg.msg_name = addr;
+    msg.msg_namelen = addr ? addrlen : 0;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_UDP;
+    cm->cmsg_type = UDP_SEGMENT;
+    cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    std::memcpy(CMSG_DATA(cm), &segment, sizeof(segment));
+    return sendmsg(fd, &msg, 0);
+}
+
+// send errors of a segmented buffer which are fixed by sending datagrams one by one:
+// no checksum offload (EIO), segment larger than path mtu (EINVAL), old kernel
+inline auto gso_error(int ec) -> bool {
+    return ec==EIO || ec==EINVAL || ec==ENOPROTOOPT || ec==EOPNOTSUPP;
+}
+
+inline auto gso_supported(int fd) -> bool {
+    int value = 0;
+    socklen_t len = sizeof(value);
+    return getsockopt(fd, SOL_UDP, UDP_SEGMENT, &value, &len)==0;
+}
+
+inline auto gro_enable(int fd) -> bool {
+    int yes = 1;
+    return setsockopt(fd, SOL_UDP, UDP_GRO, &yes, sizeof(yes))==0;
+}
+
+// recvfrom() reporting the size of coalesced datagrams, segment is 0 for a single one
+inline auto gro_recv(int fd, void* buf, int len, sockaddr* addr, socklen_t* addrlen, int& segment) -> ssize_t {
+    iovec iov{buf, size_t(len)};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    msghdr msg{};
+    msg.msg_name = addr;
+    msg.msg_namelen = addr ? *addrlen : 0;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    segment = 0;
+    ssize_t n = recvmsg(fd, &msg, 0);
+    if (n<0) return n;
+    if (addr) *addrlen = msg.msg_namelen;
+    for(cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (cm->cmsg_level==SOL_UDP && cm->cmsg_type==UDP_GRO) {
+            std::memcpy(&segment, CMSG_DATA(cm), sizeof(segment));
+        }
+    }
+    return n;
+}
+
+// Calls func(data, len) for every datagram of coalesced buffer while it returns true
+template<typename Func>
+auto for_each_segment(void* buf, int len, int segment, Func func) -> bool {
+    auto* ptr = static_cast<uint8_t*>(buf);
+    if (segment<=0 || segment>=len) return func(ptr, len);
+    for(int pos=0; pos<len; pos+=segment) {
+        if (!func(ptr+pos, std::min(segment, len-pos))) return false;
+    }
+    return true;
+}
+
+// Collects datagrams of the same size to send them by one call with UDP_SEGMENT.
+// The kernel splits the buffer back, so datagram boundaries are kept.
+// A shorter datagram is the last segment of the batch, a longer one or the
+// deadline sends the batch. The send function keeps errno on failure and
+// doesn't report gso_error() of segmented buffer, its datagrams are sent
+// one by one then.
+class GsoSender {
+public:
+    using SendFunc = std::function<int(const void*, int, uint16_t)>;
+    GsoSender(const GsoParams& params, std::unique_ptr<Timer> timer, SendFunc send):
+        _max(std::min(params.segments, GsoParams::max_segments)), _deadline(params.deadline), _timer(std::move(timer)), _send(std::move(send)) {
+        _timer->shoot([this](){ flush(); });
+    }
+    ~GsoSender() { flush();
+    }
+    // disables batching if kernel has no UDP_SEGMENT
+    void enable(bool on) {
+        flush();
+        _enabled = on;
+    }
+    auto write(const void* buf, int len) -> int {
+        if (!_enabled || len<=0 || len>max_size) {
+            flush();
+            return _send(buf, len, 0);
+        }
+        if (_count && len>_segment) flush();
+        if (!_count) {
+            _segment = len;
+            error_c ec = _timer->arm_oneshoot(_deadline);
+            if (ec) {
+                _timer->on_error(ec);
+                return _send(buf, len, 0);
+            }
+        }
+        const auto* ptr = static_cast<const uint8_t*>(buf);
+        _buffer.insert(_buffer.end(), ptr, ptr+len);
+        _count++;
+        if (len<_segment || _count==_max || int(_buffer.size())+_segment>max_size) flush();
+        return len;
+    }
+    void flush() {
+        if (!_count) return;
+        _timer->stop();
+        bool split = _count==1;
+        if (!split && _send(_buffer.data(), _buffer.size(), _segment)==-1) {
+            int ec = errno;
+            split = gso_error(ec);
+            if (split && ec!=EINVAL) { // EINVAL is for this batch only
+                log.warning()<<"UDP segmentation offload is not available: "<<strerror(ec)<<Log::endl;
+                _enabled = false;
+            }
+        }
+        if (split) {
+            for(size_t pos=0; pos<_buffer.size(); pos+=_segment) {
+                _send(_buffer.data()+pos, std::min(size_t(_segment), _buffer.size()-pos), 0);
+            }
+        }
+        _buffer.clear();
+        _count = 0;
+    }
+private:
+    static constexpr int max_size = 65000;
+    int _max;
+    std::chrono::nanoseconds _deadline;
+    std::unique_ptr<Timer> _timer;
+    SendFunc _send;
+    std::vector<uint8_t> _buffer;
+    int _segment = 0;
+    int _count = 0;
+    bool _enabled = true;
+    inline static Log::Log log {"gso"};
+};
+
+#ifdef YAML_CONFIG
+#include "yaml.h"
+inline void GsoParams::init_yaml(YAML::Node cfg) {
+    if (!cfg) return;
+    if (cfg.IsScalar()) {
+        if (cfg.as<bool>()) {
+            segments = max_segments;
+            gro = true;
+        }
+        return;
+    }
+    if (!cfg.IsMap()) return;
+    segments = max_segments;
+    if (cfg["segments"]) segments = cfg["segments"].as<int>();
+    auto d = duration(cfg["deadline"]);
+    if (d.count()) deadline = d;
+    gro = cfg["gro"] ? cfg["gro"].as<bool>() : true;
+}
+#endif //YAML_CONFIG
+
+#endif  //!__GSO__H__
@@ -2,11 +2,36 @@
 #define __INFLUX__H__
 #include "../inc/endpoints.h"
 #include "../ioloop.h"
+#include "../log.h"
+#include "spill.h"
+#include <algorithm>
 #include <deque>
+#include <vector>
 
-
+// Line protocol exporter.
+// Lines are packed into blocks of pack size, a block is written to the
+// output as a whole. Blocks which can't be written wait in memory queue
+// (queue max/shrink are counted in blocks), when it is full they are
+// spilled to the disk ring. Delivery order is memory queue, spill, then
+// new blocks, so replay after the output comes back is in order.
 class InfluxStream : public OStatEndpoint {
 public:
+    // undelivered blocks are kept in the spill for the next run
+    ~InfluxStream() override {
+        if (_out) _out->writeable(nullptr);
+        if (!_block.empty()) seal();
+        if (_blocks.empty()) return;
+        int lost = 0;
+        if (_spill.is_open()) {
+            // in reverse, so the spill keeps delivery order
+            for (auto it = _blocks.rbegin(); it!=_blocks.rend(); ++it) {
+                if (!_spill.push_front(it->data(), it->size())) lost++;
+            }
+        } else {
+            lost = _blocks.size();
+        }
+        if (lost) log.warning()<<"Dropped "<<lost<<" stat blocks on exit"<<Log::endl;
+    }
     void pack_size(int size) override { _pack_size = size;
     }
     void queue_size(int max, int shrink) override {
@@ -20,54 +45,112 @@ public:
             }
         }
     }
+    auto spill(const std::string& path, size_t size) -> error_c {
+        return _spill.init(path, size);
+    }
     void init( std::shared_ptr<Writeable> out ) {
         _out = std::move(out);
         _out->writeable([this](){ flush(); });
+        flush();
     }
-    void send(Metric&& metric) override {
-        int ps = _pack.tellp();
-        if (ps > _pack_size) {
-            if (_queue.size() > _queue_max_size) _queue.resize(_queue_shrink_size);
-            std::stringstream out;
-            metric.to_stream(_pack,_global_tags);
-            _queue.push_front(out.str());
-            return;
-        }
-        metric.to_stream(_pack,_global_tags);
-        _pack<<'\n';
-        ps = _pack.tellp();
-        if (ps > _pack_size) {
-            auto str = std::move(_pack.rdbuf()->str());
-            int ret = _out->write(str.c_str(),ps);
-            if (ret==ps) { _pack.str("");
+    // time for metrics without own time stamp, set once per reporting tick
+    void stamp(Metric::Time time) { _stamp = time;
+    }
+    void send(const Metric& metric) override {
+        if (metric.empty()) return;
+        auto stamp = _stamp==Metric::Time() ? std::chrono::system_clock::now() : _stamp;
+        _line.clear();
+        metric.serialize(_line,_global_tags,stamp);
+        _line += '\n';
+        if (!_block.empty() && int(_block.size()+_line.size()) > _pack_size) seal();
+        _block += _line;
+        if (int(_block.size()) >= _pack_size) seal();
+    }
+    // writes queued blocks, the block being filled is sent when nothing waits
+    void flush() override {
+        if (!_out) return;
+        if (_blocks.empty() && _spill.empty() && !_block.empty()) seal();
+        while(true) {
+            if (_blocks.empty()) {
+                if (_spill.empty()) break;
+                auto& block = _blocks.emplace_back(take_block());
+                _spill.front(block);
+                _spill.pop();
             }
+            auto& block = _blocks.front();
+            int ret = _out->write(block.data()+_offset, block.size()-_offset);
+            if (ret<=0) break;
+            _offset += ret;
+            if (_offset<int(block.size())) break;
+            _offset = 0;
+            recycle(std::move(block));
+            _blocks.pop_front();
+        }
+        if (_spill.dropped) {
+            log.warning()<<"Spill is full, dropped "<<_spill.dropped<<" blocks"<<Log::endl;
+            _spill.dropped = 0;
         }
     }
-    void flush() override {
-        int ps = _pack.tellp();
-        while(ps) {
-            auto str = std::move(_pack.rdbuf()->str());
-            int ret = _out->write(str.c_str(),ps);
-            if (ret==ps) { 
-                _pack.str("");
-                ps = 0;
-            } else break;
-            while(_queue.size()) {
-                _pack<<_queue.back()<<'\n';
-                _queue.pop_back();
-                ps = _pack.tellp();
-                if (ps > _pack_size) break;
+
+private:
+    void seal() {
+        if (_blocks.empty() && _spill.empty() && _out) {
+            int ret = _out->write(_block.data(), _block.size());
+            if (ret==int(_block.size())) {
+                _block.clear();
+                return;
+            }
+            if (ret>0) _offset = ret;
+        }
+        if (!_spill.empty() || (int(_blocks.size())>=_queue_max_size && _spill.is_open())) {
+            if (!_spill.push(_block.data(), _block.size())) {
+                log.warning()<<"Block of "<<_block.size()<<" bytes doesn't fit spill, dropped"<<Log::endl;
             }
+            _block.clear();
+            return;
+        }
+        if (int(_blocks.size())>=_queue_max_size) {
+            // the rest of partially written block keeps the line protocol stream whole
+            int written = _offset ? 1 : 0;
+            int drop = std::max(0, int(_blocks.size())-std::max(_queue_shrink_size, written));
+            log.warning()<<"Stat queue is full, dropped "<<drop<<" blocks"<<Log::endl;
+            auto first = _blocks.begin()+written;
+            for (auto it = first; it!=first+drop; ++it) recycle(std::move(*it));
+            _blocks.erase(first, first+drop);
         }
+        _blocks.push_back(std::move(_block));
+        _block = take_block();
+    }
+    auto take_block() -> std::string {
+        if (_free.empty()) {
+            std::string block;
+            block.reserve(_pack_size);
+            return block;
+        }
+        auto block = std::move(_free.back());
+        _free.pop_back();
+        return block;
+    }
+    void recycle(std::string&& block) {
+        if (_free.size()>=max_free) return;
+        block.clear();
+        _free.push_back(std::move(block));
     }
 
     int _pack_size = 400;
     int _queue_max_size = 10000;
     int _queue_shrink_size = 9900;
+    static constexpr size_t max_free = 16;
     std::string _global_tags;
     std::shared_ptr<Writeable> _out;
-    std::stringstream _pack;
-    std::deque<std::string> _queue;
+    Metric::Time _stamp;
+    std::string _line;
+    std::string _block;
+    int _offset = 0; // written part of the first queued block
+    std::deque<std::string> _blocks;
+    std::vector<std::string> _free;
+    SpillRing _spill;
+    inline static Log::Log log {"stats"};
 };
 
-#endif  //!__INFLUX__H__
\ No newline at end of file
+#endif  //!__INFLUX__H__
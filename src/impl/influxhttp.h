@@ -0,0 +1,128 @@
+#ifndef __INFLUXHTTP__H__
+#define __INFLUXHTTP__H__
+#include <cctype>
+#include <cstdlib>
+#include <string>
+
+#include "../err.h"
+#include "../log.h"
+#include "../inc/endpoints.h"
+
+// Writes line protocol blocks as HTTP POST requests to influxdb /write
+// (or any compatible receiver). Only one request is in flight; the block
+// is kept until the server answers, so it is sent again after reconnect
+// or 5xx response. Write returns 0 while the request is in flight, the
+// exporter keeps the following blocks and is notified by writeable event.
+class InfluxHttp : public Writeable, public error_handler {
+public:
+    InfluxHttp(std::unique_ptr<TcpClient> cli, std::string host, std::string path, std::string auth):
+        _tcp(std::move(cli)),_host(std::move(host)),_path(std::move(path)),_auth(std::move(auth)) {
+        _tcp->on_error([this](error_c& ec){ on_error(ec,"influx http"); });
+        _tcp->on_connect([this](std::shared_ptr<Client> cli, std::string name){
+            _cli = std::move(cli);
+            _waiting = false;
+            _sent = 0;
+            _response.clear();
+            _cli->on_read([this](void* buf, int len){ on_response(static_cast<char*>(buf),len); });
+            _cli->on_close([this](){
+                _cli.reset();
+                _waiting = false;
+                _is_writeable = false;
+            });
+            _cli->writeable([this](){ if (_waiting) send_request(); });
+            _cli->on_error([this](error_c& ec){ on_error(ec,"influx http"); });
+            if (!_body.empty()) { post();
+            } else { writeable();
+            }
+        });
+    }
+    auto init(const std::string& address, uint16_t port) -> error_c {
+        return _tcp->init(address, port);
+    }
+    auto write(const void* buf, int len) -> int override {
+        if (!_cli || _waiting) return 0;
+        if (!_body.empty()) {
+            // previous request failed, retry it first
+            post();
+            return 0;
+        }
+        _body.assign(static_cast<const char*>(buf), len);
+        post();
+        return len;
+    }
+
+private:
+    void post() {
+        _request.clear();
+        _request += "POST ";
+        _request += _path;
+        _request += " HTTP/1.1\r\nHost: ";
+        _request += _host;
+        _request += "\r\nContent-Type: text/plain; charset=utf-8\r\nContent-Length: ";
+        _request += std::to_string(_body.size());
+        if (!_auth.empty()) {
+            _request += "\r\nAuthorization: ";
+            _request += _auth;
+        }
+        _request += "\r\n\r\n";
+        _request += _body;
+        _sent = 0;
+        _waiting = true;
+        _is_writeable = false;
+        send_request();
+    }
+    void send_request() {
+        if (!_cli || _sent>=int(_request.size())) return;
+        int ret = _cli->write(_request.data()+_sent, _request.size()-_sent);
+        if (ret>0) _sent += ret;
+    }
+    void on_response(const char* buf, int len) {
+        _response.append(buf, len);
+        auto end = _response.find("\r\n\r\n");
+        if (end==std::string::npos) return;
+        size_t body = end+4;
+        size_t length = 0;
+        auto pos = find_header("content-length:", end);
+        if (pos!=std::string::npos) length = std::strtoul(_response.c_str()+pos, nullptr, 10);
+        if (_response.size() < body+length) return;
+        int status = 0;
+        auto sp = _response.find(' ');
+        if (sp!=std::string::npos && sp<end) status = std::atoi(_response.c_str()+sp+1);
+        _waiting = false;
+        if (status>=200 && status<300) {
+            _body.clear();
+        } else if (status>=400 && status<500) {
+            log.error()<<"Influx rejected block: "<<_response.substr(0,_response.find("\r\n"))<<" "<<_response.substr(body,length)<<Log::endl;
+            _body.clear();
+        } else {
+            // server is busy, the block is sent again on the next write
+            log.warning()<<"Influx write failed: "<<_response.substr(0,_response.find("\r\n"))<<Log::endl;
+            _response.erase(0, body+length);
+            return;
+        }
+        _response.erase(0, body+length);
+        writeable();
+    }
+    auto find_header(const std::string& name, size_t end) -> size_t {
+        for(size_t pos = _response.find("\r\n"); pos!=std::string::npos && pos<end; pos = _response.find("\r\n",pos+2)) {
+            size_t i = 0;
+            while (i<name.size() && std::tolower(_response[pos+2+i])==name[i]) i++;
+            if (i==name.size()) return pos+2+i;
+        }
+        return std::string::npos;
+    }
+
+    std::unique_ptr<TcpClient> _tcp;
+    std::shared_ptr<Client> _cli;
+    std::string _host;
+    std::string _path;
+    std::string _auth;
+    std::string _body;
+    std::string _request;
+    std::string _response;
+    int _sent = 0;
+    bool _waiting = false;
+    inline static Log::Log log {"stats"};
+};
+
+#endif  //!__INFLUXHTTP__H__
@@ -0,0 +1,141 @@
+#ifndef __PEERS__H__
+#define __PEERS__H__
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Source address of a datagram as received from the kernel.
+// Compared bytewise, flowinfo of ipv6 address is cleared since it may
+// differ from datagram to datagram of the same peer.
+struct PeerKey {
+    union {
+        sockaddr sa;
+        sockaddr_in in;
+        sockaddr_in6 in6;
+    } addr;
+    socklen_t len = sizeof(addr);
+
+    auto sock_addr() -> sockaddr* { return &addr.sa;
+    }
+    // to be called after recvfrom
+    auto normalize() -> bool {
+        if (len>sizeof(addr)) return false;
+        if (addr.sa.sa_family==AF_INET6) addr.in6.sin6_flowinfo = 0;
+        return true;
+    }
+    auto hash() const -> uint64_t { // FNV-1a
+        uint64_t h = 0xcbf29ce484222325ULL;
+        auto* p = reinterpret_cast<const uint8_t*>(&addr);
+        for(socklen_t i=0;i<len;i++) {
+            h ^= p[i];
+            h *= 0x100000001b3ULL;
+        }
+        return h;
+    }
+    auto operator==(const PeerKey& other) const -> bool {
+        return len==other.len && std::memcmp(&addr,&other.addr,len)==0;
+    }
+};
+
+// Errors of connected udp socket after route change, the socket has to be
+// connected again to select new route and source address.
+inline auto udp_route_error(int ec) -> bool {
+    return ec==ENETUNREACH || ec==EHOSTUNREACH || ec==ENETDOWN || ec==EADDRNOTAVAIL;
+}
+
+// Pending error of the socket set by ICMP message, 0 if none
+inline auto udp_socket_error(int fd) -> int {
+    int ec = 0;
+    socklen_t len = sizeof(ec);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &ec, &len)==-1) return errno;
+    return ec;
+}
+
+// Open addressing hash of peers of one socket with linear probing.
+// It is a cache in front of the name resolution: entries are filled on the
+// first datagram of a peer and the table is cleared when zeroconf services
+// change. Entries of gone peers are dropped by erase_if().
+template<typename T>
+class PeerTable {
+public:
+    PeerTable() { _slots.resize(16);
+    }
+    auto find(const PeerKey& key) -> T* {
+        uint64_t h = key.hash();
+        size_t mask = _slots.size()-1;
+        for(size_t i = h & mask;;i = (i+1) & mask) {
+            auto& slot = _slots[i];
+            if (!slot.used) return nullptr;
+            if (slot.hash==h && slot.key==key) return &slot.value;
+        }
+    }
+    auto insert(const PeerKey& key, T value) -> T& {
+        T* found = find(key);
+        if (found) {
+            *found = std::move(value);
+            return *found;
+        }
+        if ((_size+1)*2>_slots.size()) grow();
+        _size++;
+        return place(key, key.hash(), std::move(value));
+    }
+    void clear() {
+        for(auto& slot : _slots) slot = Slot();
+        _size = 0;
+    }
+    // drops entries matching pred, the table shrinks if most of it is free
+    template<typename Pred>
+    void erase_if(Pred pred) {
+        size_t capacity = 16;
+        size_t left = 0;
+        for(auto& slot : _slots) {
+            if (slot.used && !pred(slot.value)) left++;
+        }
+        while (capacity<left*4) capacity *= 2;
+        std::vector<Slot> old(capacity);
+        old.swap(_slots);
+        _size = 0;
+        for(auto& slot : old) {
+            if (!slot.used || pred(slot.value)) continue;
+            place(slot.key, slot.hash, std::move(slot.value));
+            _size++;
+        }
+    }
+    auto size() const -> size_t { return _size;
+    }
+
+private:
+    struct Slot {
+        PeerKey key;
+        uint64_t hash = 0;
+        T value{};
+        bool used = false;
+    };
+    auto place(const PeerKey& key, uint64_t h, T value) -> T& {
+        size_t mask = _slots.size()-1;
+        size_t i = h & mask;
+        while(_slots[i].used) i = (i+1) & mask;
+        auto& slot = _slots[i];
+        slot.key = key;
+        slot.hash = h;
+        slot.value = std::move(value);
+        slot.used = true;
+        return slot.value;
+    }
+    void grow() {
+        std::vector<Slot> old(_slots.size()*2);
+        old.swap(_slots);
+        for(auto& slot : old) {
+            if (slot.used) place(slot.key, slot.hash, std::move(slot.value));
+        }
+    }
+
+    std::vector<Slot> _slots;
+    size_t _size = 0;
+};
+
+#endif  //!__PEERS__H__
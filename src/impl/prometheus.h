@@ -0,0 +1,166 @@
+#ifndef __PROMETHEUS__H__
+#define __PROMETHEUS__H__
+#include <functional>
+#include <list>
+#include <map>
+#include <string>
+
+#include "../err.h"
+#include "../log.h"
+#include "../inc/endpoints.h"
+#include "../inc/stat.h"
+
+// Serves stats on GET /metrics in OpenMetrics text format.
+// Values are collected on scrape only. Samples of one family may come from
+// several stats (e.g. every tcp stream), so they are grouped by family name
+// before output. Buffers are kept between scrapes.
+class PromExporter : public OExpose, public error_handler {
+public:
+    using Collect = std::function<void(OExpose&)>;
+    PromExporter(std::unique_ptr<TcpServer> svr, Collect collect):_svr(std::move(svr)),_collect(std::move(collect)) {
+        _svr->on_error([this](error_c& ec){ on_error(ec,"prometheus"); });
+        _svr->on_connect([this](std::shared_ptr<Client> cli, std::string name){
+            // closed sessions are released here, not inside their own callbacks
+            _sessions.remove_if([](auto& e){ return e.closed; });
+            auto& session = _sessions.emplace_front();
+            session.cli = std::move(cli);
+            auto* s = &session;
+            session.cli->on_read([this,s](void* buf, int len){ on_request(*s,static_cast<char*>(buf),len); });
+            session.cli->writeable([this,s](){ send(*s); });
+            session.cli->on_close([s](){ s->closed = true; });
+            session.cli->on_error([this](error_c& ec){ on_error(ec,"prometheus"); });
+        });
+    }
+    auto init(uint16_t port, const std::string& address) -> error_c {
+        if (!address.empty()) _svr->address(address);
+        return _svr->init(port);
+    }
+    void counter(std::string_view name, std::string_view field, std::string_view labels, double value) override {
+        auto& samples = family(name, field, "counter");
+        sample(samples, "_total", labels, {}, value);
+    }
+    void counter(std::string_view name, std::string_view field, std::string_view labels, std::string_view label, double value) override {
+        auto& samples = family(name, field, "counter");
+        sample(samples, "_total", labels, label, value);
+    }
+    void histogram(std::string_view name, std::string_view field, std::string_view labels,
+                   const std::vector<int64_t>& edges, const std::vector<int64_t>& counts, double sum) override {
+        auto& samples = family(name, field, "histogram");
+        int64_t total = 0;
+        for(size_t i=0;i<counts.size();i++) {
+            total += counts[i];
+            _le.assign("le=\"");
+            if (i<edges.size()) { _le += std::to_string(edges[i]);
+            } else {              _le += "+Inf";
+            }
+            _le += '"';
+            sample(samples, "_bucket", labels, _le, total);
+        }
+        sample(samples, "_sum", labels, {}, sum);
+        sample(samples, "_count", labels, {}, total);
+    }
+
+private:
+    struct Session {
+        std::shared_ptr<Client> cli;
+        std::string input;
+        std::string output;
+        size_t sent = 0;
+        bool closed = false;
+    };
+
+    void on_request(Session& s, const char* buf, int len) {
+        s.input.append(buf,len);
+        while(true) {
+            auto end = s.input.find("\r\n\r\n");
+            if (end==std::string::npos) break;
+            auto line = s.input.substr(0,s.input.find("\r\n"));
+            s.input.erase(0,end+4);
+            if (line.rfind("GET /metrics ",0)==0 || line.rfind("GET / ",0)==0) {
+                render(s.output);
+            } else {
+                s.output += "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+            }
+        }
+        if (s.input.size()>max_request) {
+            log.warning()<<"Request is too long, drop "<<s.cli->get_peer_name()<<Log::endl;
+            s.input.clear();
+        }
+        send(s);
+    }
+    struct Family {
+        const char* type;
+        std::string samples;
+    };
+    // samples of uavr_<name>_<field>, the family keeps the type of the first one
+    auto family(std::string_view name, std::string_view field, const char* type) -> std::string& {
+        _key.assign("uavr_");
+        append_name(_key,name);
+        _key += '_';
+        append_name(_key,field);
+        auto it = _families.find(_key);
+        if (it==_families.end()) it = _families.emplace(_key,Family{type,std::string()}).first;
+        return it->second.samples;
+    }
+    void sample(std::string& samples, std::string_view suffix, std::string_view labels, std::string_view extra, double value) {
+        samples += _key;
+        samples += suffix;
+        if (!labels.empty() || !extra.empty()) {
+            samples += '{';
+            samples += labels;
+            if (!labels.empty() && !extra.empty()) samples += ',';
+            samples += extra;
+            samples += '}';
+        }
+        samples += ' ';
+        Metric::append(samples, value);
+        samples += '\n';
+    }
+    void render(std::string& out) {
+        for(auto& family : _families) family.second.samples.clear();
+        _collect(*this);
+        _body.clear();
+        for(auto& family : _families) {
+            if (family.second.samples.empty()) continue;
+            _body += "# TYPE ";
+            _body += family.first;
+            _body += ' ';
+            _body += family.second.type;
+            _body += '\n';
+            _body += family.second.samples;
+        }
+        _body += "# EOF\n";
+        out += "HTTP/1.1 200 OK\r\nContent-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\nContent-Length: ";
+        out += std::to_string(_body.size());
+        out += "\r\n\r\n";
+        out += _body;
+    }
+    void send(Session& s) {
+        if (s.closed) return;
+        while(s.sent<s.output.size()) {
+            int ret = s.cli->write(s.output.data()+s.sent, s.output.size()-s.sent);
+            if (ret<=0) return; // rest is sent when socket is writeable
+            s.sent += ret;
+        }
+        s.output.clear();
+        s.sent = 0;
+    }
+    static void append_name(std::string& out, std::string_view name) {
+        for(char c : name) {
+            bool valid = (c>='a' && c<='z') || (c>='A' && c<='Z') || (c>='0' && c<='9') || c=='_' || c==':';
+            out += valid ? c : '_';
+        }
+    }
+
+    static constexpr size_t max_request = 8192;
+    std::unique_ptr<TcpServer> _svr;
+    Collect _collect;
+    std::list<Session> _sessions;
+    std::map<std::string,Family,std::less<>> _families;
+    std::string _key;
+    std::string _le;
+    std::string _body;
+    inline static Log::Log log {"stats"};
+};
+
+#endif  //!__PROMETHEUS__H__
@@ -0,0 +1,300 @@
+#ifndef __PTY_IMPL_H__
+#define __PTY_IMPL_H__
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <forward_list>
+#include <vector>
+using namespace std::chrono_literals;
+
+#include "../err.h"
+#include "../loop.h"
+#include "../log.h"
+#include "splice.h"
+#include "statobj.h"
+#include "uart.h"
+#include "yaml.h"
+
+// UART client which writes not faster than a serial line of the baudrate
+// (8N1, 10 bits per byte). Bytes above the rate wait in the queue for the
+// pacing timer, a packet which doesn't fit to one second of queue is dropped.
+class PtyClient : public UARTClient {
+public:
+    PtyClient(const std::string& name, int fd, std::shared_ptr<StatCounters>& cnt, int baudrate, Timer* timer):
+        UARTClient(name, fd, cnt), _rate(baudrate/10), _timer(timer) {
+        _last = std::chrono::steady_clock::now();
+        _credit = burst();
+    }
+    auto write(const void* buf, int len) -> int override {
+        if (!_rate) return UARTClient::write(buf, len);
+        if (!_is_writeable && _queue.empty()) return 0;
+        if (_queue.size()+len > size_t(std::max(_rate, 4096))) return 0;
+        auto* data = static_cast<const char*>(buf);
+        _queue.insert(_queue.end(), data, data+len);
+        flush();
+        return len;
+    }
+    // paced data bypasses the queue
+    auto splice_fd() -> int override { return _rate ? -1 : _fd;
+    }
+    void flush() {
+        if (!_is_writeable || _queue.empty()) return;
+        auto now = std::chrono::steady_clock::now();
+        _credit = std::min<int64_t>(burst(), _credit + std::chrono::duration_cast<std::chrono::microseconds>(now-_last).count()*_rate/1000000);
+        _last = now;
+        int n = std::min<int64_t>(_credit, _queue.size());
+        if (n>0) {
+            n = UARTClient::write(_queue.data(), n);
+            if (n<=0) return; // continues on EPOLLOUT
+            _credit -= n;
+            _queue.erase(_queue.begin(), _queue.begin()+n);
+        }
+        if (_queue.empty() || _pacing) return;
+        int64_t wait = std::min<int64_t>(burst(), _queue.size()) - _credit;
+        error_c ret = _timer->arm_oneshoot(std::chrono::microseconds(std::max<int64_t>(1000, wait*1000000/_rate)));
+        if (ret) { on_error(ret, "pty pacing");
+        } else { _pacing = true;
+        }
+    }
+    void paced() {
+        _pacing = false;
+        flush();
+    }
+private:
+    auto burst() const -> int64_t { return std::max(_rate/100, 16); // 10ms of the line
+    }
+    int _rate; // bytes per second, 0 - not paced
+    int64_t _credit = 0;
+    std::chrono::steady_clock::time_point _last;
+    std::vector<char> _queue;
+    Timer* _timer;
+    bool _pacing = false; // the timer is armed
+    friend class PtyImpl;
+};
+
+// Pseudo-terminal for programs which talk to serial ports only. The slave
+// device is published by the symlink, the router keeps the slave open
+// itself so the master doesn't hang up between consumers.
+class PtyImpl : public Pty, public IOPollable {
+public:
+    PtyImpl(std::string name, IOLoopSvc* loop): IOPollable("pty"), _name(std::move(name)), _loop(loop) {
+        _timer = loop->timer();
+        _timer->shoot([this]() {
+            if (auto client = _client.lock()) client->paced();
+        });
+    }
+    ~PtyImpl() override {
+        _exists = false;
+        if (_fd != -1) _loop->poll()->del(_fd, this);
+        _timer->stop();
+        cleanup();
+    }
+
+#ifdef YAML_CONFIG
+    auto init_yaml(YAML::Node cfg) -> error_c override {
+        auto statcfg = cfg["stat"];
+        if (statcfg && statcfg.IsMap()) {
+            auto period = duration(statcfg["period"]);
+            if (period.count()) {
+                stat_period = period;
+            }
+            auto tags = statcfg["tags"];
+            if (tags && tags.IsMap()) {
+                for(auto tag : tags) {
+                    stat_tags.push_front(make_pair(tag.first.as<std::string>(),tag.second.as<std::string>()));
+                }
+            }
+        }
+        if (cfg["mode"]) _mode = std::stoi(cfg["mode"].as<std::string>(), nullptr, 8);
+        if (!cfg["link"]) return errno_c(ENOTSUP,"pty link path");
+        int baudrate = 0;
+        if (cfg["baudrate"]) baudrate = cfg["baudrate"].as<int>();
+        return init(cfg["link"].as<std::string>(), baudrate);
+    }
+#endif
+
+    auto init(const std::string& link, int baudrate) -> error_c override {
+        if (baudrate && bauds.find(baudrate)==bauds.end()) return errno_c(EINVAL,"pty baudrate");
+        _link = link;
+        _baudrate = baudrate;
+        _timer->on_error([this](error_c& ec){ on_error(ec,_name);});
+        cnt = std::make_shared<StatCounters>("pty");
+        cnt->set_tags(stat_tags);
+        cnt->add_tag({"endpoint",_name});
+        if (stat_period.count()) _loop->stats()->register_report(cnt, stat_period);
+        error_c ret = create();
+        if (ret) {
+            cleanup();
+            return ret;
+        }
+        ret = _loop->poll()->add(_fd, EPOLLIN | EPOLLOUT | EPOLLET, this);
+        if (ret) return ret;
+        cli();
+        return error_c();
+    }
+
+    auto create() -> error_c {
+        _fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+        if (_fd==-1) return errno_c("pty open");
+        if (grantpt(_fd)==-1) return errno_c("pty grant");
+        if (unlockpt(_fd)==-1) return errno_c("pty unlock");
+        char path[PATH_MAX];
+        int ec = ptsname_r(_fd, path, sizeof(path));
+        if (ec) return errno_c(ec, "pty name");
+        _slave_path = path;
+        _slave = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+        if (_slave==-1) return errno_c("pty slave "+_slave_path);
+        struct termios tty;
+        error_c ret = to_errno_c(tcgetattr(_slave, &tty),"tcgetattr");
+        if (ret) return ret;
+        cfmakeraw(&tty);
+        tty.c_cflag |= CLOCAL | CREAD;
+        if (_baudrate) {
+            // consumers see the speed of the emulated port
+            cfsetspeed(&tty, bauds[_baudrate]);
+        }
+        ret = to_errno_c(tcsetattr(_slave, TCSANOW, &tty),"tcsetattr");
+        if (ret) return ret;
+        if (_mode) {
+            ret = to_errno_c(fchmod(_slave, _mode),"pty mode");
+            if (ret) return ret;
+        }
+        struct stat sb;
+        if (lstat(_link.c_str(), &sb)==0) {
+            if (!S_ISLNK(sb.st_mode)) return errno_c(EEXIST,"pty link "+_link);
+            unlink(_link.c_str()); // left by the previous run
+        }
+        if (symlink(path, _link.c_str())==-1) return errno_c("pty link "+_link);
+        _linked = true;
+        log.info()<<"Pty "<<_link<<" -> "<<_slave_path<<Log::endl;
+        return error_c();
+    }
+
+    auto epollIN() -> int override {
+        if (_splicer.enabled()) {
+            int ret = splice_in();
+            if (ret!=NOT_HANDLED) return ret;
+        }
+        int n = 1024;
+        while(n==1024) {
+            std::array<char,1024> buffer;
+            n = read(_fd, buffer.data(), buffer.size());
+            if (n == -1) {
+                errno_c ret;
+                if (ret != std::error_condition(std::errc::resource_unavailable_try_again)) {
+                    on_error(ret, "pty read");
+                    if (!_exists) return STOP;
+                }
+                break;
+            }
+            if (n==0) break;
+            cnt->add(StatCounters::READ,n);
+            if (auto client = cli()) {
+                client->on_read(buffer.data(), n);
+            }
+            if (!_exists) return STOP;
+        }
+        return HANDLED;
+    }
+
+    // unfiltered route to one stream endpoint, the data stays in the kernel
+    auto splice_in() -> int {
+        while(true) {
+            auto client = _client.lock();
+            Spliceable* sink = client ? client->splice_sink() : nullptr;
+            if (!sink) return NOT_HANDLED;
+            int n = _splicer.pass(_fd, sink);
+            if (!_exists) return STOP;
+            if (n>0) {
+                cnt->add(StatCounters::READ,n);
+                continue;
+            }
+            if (n==-1) {
+                errno_c ret;
+                if (ret == std::error_condition(std::errc::resource_unavailable_try_again)) return HANDLED;
+            }
+            return NOT_HANDLED; // read() reports the end or the error
+        }
+    }
+
+    // the consumer has read the slave input queue
+    auto epollOUT() -> int override {
+        if (auto client = _client.lock()) {
+            client->writeable();
+            client->flush();
+        }
+        return HANDLED;
+    }
+
+    auto epollHUP() -> int override {
+        log.debug()<<"EPOLLHUP on pty "<<_link<<Log::endl;
+        return HANDLED;
+    }
+
+    void cleanup() override {
+        if (auto client = _client.lock()) {
+            client->_is_writeable = false;
+            client->_fd = -1;
+            client->_queue.clear();
+            client->on_close();
+        }
+        _client.reset();
+        if (_linked) {
+            // the link may be taken by another router already
+            char target[PATH_MAX];
+            ssize_t n = readlink(_link.c_str(), target, sizeof(target)-1);
+            if (n>0 && std::string(target, n)==_slave_path) unlink(_link.c_str());
+            _linked = false;
+        }
+        if (_slave != -1) {
+            close(_slave);
+            _slave = -1;
+        }
+        if (_fd != -1) {
+            close(_fd);
+            _fd = -1;
+        }
+    }
+
+    auto cli() -> std::shared_ptr<PtyClient> {
+        auto ret = _client.lock();
+        if (!ret && _fd!=-1) {
+            ret = std::make_shared<PtyClient>(_link, _fd, cnt, _baudrate, _timer.get());
+            ret->on_error([this](error_c ec){on_error(ec);});
+            _client = ret;
+            ret->writeable();
+            on_connect(ret, ret->get_peer_name());
+        }
+        return ret;
+    }
+
+private:
+    std::string _name;
+    std::string _link;
+    std::string _slave_path;
+    int _baudrate = 0;
+    mode_t _mode = 0;
+    bool _linked = false;
+
+    int _fd = -1;    // master
+    int _slave = -1;
+    std::weak_ptr<PtyClient> _client;
+    Splicer _splicer;
+    bool _exists = true;
+
+    IOLoopSvc* _loop;
+    std::unique_ptr<Timer> _timer;
+    std::chrono::nanoseconds stat_period = 1s;
+    std::forward_list<std::pair<std::string,std::string>> stat_tags;
+    std::shared_ptr<StatCounters> cnt;
+    inline static Log::Log log {"pty"};
+};
+
+#endif  //!__PTY_IMPL_H__
@@ -0,0 +1,192 @@
+#ifndef __SHMRING_IMPL_H__
+#define __SHMRING_IMPL_H__
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <forward_list>
+using namespace std::chrono_literals;
+
+#include "../err.h"
+#include "../loop.h"
+#include "../log.h"
+#include "../shmring.h"
+#include "statobj.h"
+#include "yaml.h"
+
+// The process on the other side of the rings
+class ShmRingClient : public Client {
+public:
+    ShmRingClient(const std::string& name, shmring::Queue down, std::shared_ptr<StatCounters> cnt):
+        _name(name),_down(down),_cnt(std::move(cnt)) {
+        _cnt_dropped = _cnt->handle("dropped");
+        _cnt_broken = _cnt->handle("broken");
+    }
+    auto write(const void* buf, int len) -> int override {
+        if (!_is_writeable) return 0; // the rings are unmapped
+        if (!_down.write(buf, len)) {
+            _cnt->add(_cnt_dropped,1);
+            return 0;
+        }
+        _cnt->add(StatCounters::WRITE,len);
+        return len;
+    }
+    auto get_peer_name() -> const std::string& override {
+        return _name;
+    }
+private:
+    std::string _name;
+    shmring::Queue _down;
+    std::shared_ptr<StatCounters> _cnt;
+    StatCounters::Handle _cnt_dropped;
+    StatCounters::Handle _cnt_broken;
+    friend class ShmRingImpl;
+};
+
+// Writer of the rings segment. Routed packets are copied to the down ring
+// directly, packets of the up ring are passed to routes from the ring
+// memory. The router waits for the up doorbell in the loop.
+class ShmRingImpl : public ShmRing, public IOPollable {
+public:
+    ShmRingImpl(const std::string name, IOLoopSvc* loop):IOPollable(name),_loop(loop) {}
+    ~ShmRingImpl() override {
+        if (_up_bell!=-1) _loop->poll()->del(_up_bell, this);
+        if (_client) _client->on_close();
+        cleanup();
+    }
+
+#ifdef YAML_CONFIG
+    auto init_yaml(YAML::Node cfg) -> error_c override {
+        auto statcfg = cfg["stat"];
+        if (statcfg && statcfg.IsMap()) {
+            auto period = duration(statcfg["period"]);
+            if (period.count()) {
+                stat_period = period;
+            }
+            auto tags = statcfg["tags"];
+            if (tags && tags.IsMap()) {
+                for(auto tag : tags) {
+                    stat_tags.push_front(make_pair(tag.first.as<std::string>(),tag.second.as<std::string>()));
+                }
+            }
+        }
+        std::string segment = name;
+        if (cfg["name"]) segment = cfg["name"].as<std::string>();
+        size_t size = 1<<20;
+        if (cfg["size"]) size = cfg["size"].as<size_t>();
+        return init(segment, size);
+    }
+#endif
+
+    auto init(const std::string& segment, size_t size) -> error_c override {
+        if (size<4096 || size>(size_t(1)<<30)) return errno_c(EINVAL,"ring size");
+        size_t capacity = 4096;
+        while (capacity<size) capacity *= 2;
+        error_c ec = create(segment, capacity);
+        if (ec) {
+            cleanup();
+            return ec;
+        }
+        auto cnt = std::make_shared<StatCounters>("shmring");
+        cnt->set_tags(stat_tags);
+        cnt->add_tag({"endpoint",segment});
+        if (stat_period.count()) _loop->stats()->register_report(cnt, stat_period);
+        auto* base = static_cast<uint8_t*>(_map);
+        _client = std::make_shared<ShmRingClient>(segment, shmring::Queue(&_hdr->down, base+_hdr->down.offset, _down_bell), std::move(cnt));
+        _client->on_error([this](error_c ec){on_error(ec);});
+        _client->writeable();
+        log.info()<<"Rings /dev/shm/"<<segment<<" of "<<capacity<<" bytes"<<Log::endl;
+        on_connect(_client, segment);
+        return error_c();
+    }
+
+    auto create(const std::string& segment, size_t capacity) -> error_c {
+        _segment = segment;
+        _size = shmring::segment_size(capacity);
+        int fd = shm_open(("/"+segment).c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0660);
+        if (fd==-1) return errno_c("shm open");
+        if (ftruncate(fd, _size)==-1) {
+            errno_c ret("shm truncate");
+            close(fd);
+            return ret;
+        }
+        void* map = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map==MAP_FAILED) return errno_c("shm mmap");
+        _map = map;
+        for(auto dir : {"down","up"}) {
+            auto path = shmring::bell_path(segment, dir);
+            unlink(path.c_str());
+            if (mkfifo(path.c_str(), 0660)==-1) return errno_c("doorbell "+path);
+        }
+        // O_RDWR: the FIFO doesn't wait for the other side and never reports its end
+        _down_bell = open(shmring::bell_path(segment,"down").c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (_down_bell==-1) return errno_c("down doorbell");
+        _up_bell = open(shmring::bell_path(segment,"up").c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (_up_bell==-1) return errno_c("up doorbell");
+        _hdr = static_cast<shmring::Header*>(map);
+        _hdr->version = shmring::VERSION;
+        _hdr->pid = getpid();
+        _hdr->down.capacity = _hdr->up.capacity = capacity;
+        _hdr->down.offset = sizeof(shmring::Header);
+        _hdr->up.offset = sizeof(shmring::Header)+capacity;
+        _up = shmring::Queue(&_hdr->up, static_cast<uint8_t*>(map)+_hdr->up.offset, _up_bell);
+        _up.sleep(); // the client rings while the router waits in the loop
+        error_c ret = _loop->poll()->add(_up_bell, EPOLLIN, this);
+        if (ret) return ret;
+        // magic is the last, clients check it first
+        std::atomic_thread_fence(std::memory_order_release);
+        _hdr->magic = shmring::MAGIC;
+        return error_c();
+    }
+
+    auto epollIN() -> int override {
+        auto client = _client;
+        do {
+            int n = _up.read([&client](uint8_t* data, int len){
+                client->_cnt->add(StatCounters::READ,len);
+                client->on_read(data, len);
+            });
+            if (n<0) {
+                // the client wrote garbage, its packets are dropped
+                client->_cnt->add(client->_cnt_broken,1);
+                _up.skip();
+            }
+        } while (!_up.sleep());
+        return HANDLED;
+    }
+
+    void cleanup() override {
+        if (_down_bell!=-1) close(_down_bell);
+        if (_up_bell!=-1) close(_up_bell);
+        _down_bell = _up_bell = -1;
+        if (_client) _client->_is_writeable = false;
+        if (_map) {
+            munmap(_map, _size);
+            shm_unlink(("/"+_segment).c_str());
+            unlink(shmring::bell_path(_segment,"down").c_str());
+            unlink(shmring::bell_path(_segment,"up").c_str());
+        }
+        _map = nullptr;
+        _hdr = nullptr;
+    }
+
+private:
+    IOLoopSvc* _loop;
+    std::string _segment;
+    void* _map = nullptr;
+    size_t _size = 0;
+    shmring::Header* _hdr = nullptr;
+    shmring::Queue _up;
+    int _down_bell = -1;
+    int _up_bell = -1;
+    std::shared_ptr<ShmRingClient> _client;
+    std::chrono::nanoseconds stat_period = 1s;
+    std::forward_list<std::pair<std::string,std::string>> stat_tags;
+    inline static Log::Log log {"shmring"};
+};
+
+#endif  //!__SHMRING_IMPL_H__
@@ -0,0 +1,100 @@
+#ifndef __SHMSHARE__H__
+#define __SHMSHARE__H__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <string>
+
+#include "../err.h"
+#include "../log.h"
+#include "../shmstat.h"
+#include "../inc/stat.h"
+
+// Writer side of the shared counters segment.
+// Entries are allocated when a stat is shared and released with the stat,
+// directory changes are made inside seqlock.
+class ShmStatSegment : public StatShare {
+public:
+    ~ShmStatSegment() override {
+        if (_hdr) {
+            munmap(_hdr, shmstat::segment_size(_hdr->capacity));
+            shm_unlink(("/"+_name).c_str());
+        }
+    }
+    auto init(const std::string& name, int capacity) -> error_c {
+        if (capacity<=0) return errno_c(EINVAL,"shm capacity");
+        size_t size = shmstat::segment_size(capacity);
+        int fd = shm_open(("/"+name).c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd==-1) return errno_c("shm open");
+        if (ftruncate(fd, size)==-1) {
+            errno_c ret("shm truncate");
+            close(fd);
+            return ret;
+        }
+        void* map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map==MAP_FAILED) return errno_c("shm mmap");
+        _name = name;
+        _hdr = static_cast<shmstat::Header*>(map);
+        _entries = reinterpret_cast<shmstat::Entry*>(_hdr+1);
+        _hdr->version = shmstat::VERSION;
+        _hdr->capacity = capacity;
+        _hdr->entry_size = sizeof(shmstat::Entry);
+        _hdr->seq.store(0, std::memory_order_relaxed);
+        _hdr->count.store(0, std::memory_order_relaxed);
+        _hdr->pid = getpid();
+        // magic is the last, readers check it first
+        std::atomic_thread_fence(std::memory_order_release);
+        _hdr->magic = shmstat::MAGIC;
+        return error_c();
+    }
+
+    auto slot(std::string_view key, uint32_t kind) -> std::atomic<int64_t>* override {
+        uint32_t count = _hdr->count.load(std::memory_order_relaxed);
+        uint32_t index = 0;
+        while (index<count && _entries[index].kind!=shmstat::FREE) index++;
+        if (index==_hdr->capacity) {
+            if (!_full) log.warning()<<"Shared stats segment is full, "<<key<<" is not shared"<<Log::endl;
+            _full = true;
+            return nullptr;
+        }
+        auto& e = _entries[index];
+        begin();
+        e.value.store(0, std::memory_order_relaxed);
+        e.kind = kind;
+        size_t len = std::min(key.size(), size_t(shmstat::KEY_SIZE-1));
+        std::memcpy(e.key, key.data(), len);
+        e.key[len] = 0;
+        if (index==count) _hdr->count.store(count+1, std::memory_order_relaxed);
+        end();
+        return &e.value;
+    }
+    void release(std::atomic<int64_t>* value) override {
+        if (!value) return;
+        auto* e = reinterpret_cast<shmstat::Entry*>(reinterpret_cast<char*>(value)-offsetof(shmstat::Entry,value));
+        begin();
+        e->kind = shmstat::FREE;
+        e->key[0] = 0;
+        end();
+        _full = false;
+    }
+
+private:
+    void begin() {
+        _hdr->seq.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+    void end() {
+        _hdr->seq.fetch_add(1, std::memory_order_release);
+    }
+
+    std::string _name;
+    shmstat::Header* _hdr = nullptr;
+    shmstat::Entry* _entries = nullptr;
+    bool _full = false;
+    inline static Log::Log log {"stats"};
+};
+
+#endif  //!__SHMSHARE__H__
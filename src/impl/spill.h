@@ -0,0 +1,156 @@
+#ifndef __SPILL__H__
+#define __SPILL__H__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "../err.h"
+
+// Bounded ring of variable length records in a memory mapped file.
+// Keeps blocks which can't be delivered now. When the ring is full the
+// oldest blocks are overwritten. Ring state is kept in the file header, so
+// blocks left from the previous run are replayed after restart.
+class SpillRing {
+public:
+    SpillRing() = default;
+    SpillRing(const SpillRing&) = delete;
+    auto operator=(const SpillRing&) -> SpillRing& = delete;
+    ~SpillRing() { close();
+    }
+
+    auto init(const std::string& path, size_t size) -> error_c {
+        close();
+        if (size < sizeof(Header)+sizeof(uint32_t)+1 || size-sizeof(Header) > UINT32_MAX) return errno_c(EINVAL,"spill size");
+        _fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (_fd==-1) return errno_c("spill open");
+        if (ftruncate(_fd, size)==-1) {
+            errno_c ret("spill truncate");
+            close();
+            return ret;
+        }
+        void* map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+        if (map==MAP_FAILED) {
+            errno_c ret("spill mmap");
+            close();
+            return ret;
+        }
+        _map = static_cast<uint8_t*>(map);
+        _size = size;
+        _hdr = reinterpret_cast<Header*>(_map);
+        uint32_t bytes = size-sizeof(Header);
+        if (_hdr->magic!=MAGIC || _hdr->bytes!=bytes || _hdr->head>=bytes || _hdr->used>bytes || _hdr->count>_hdr->used/sizeof(uint32_t)) {
+            reset();
+            _hdr->magic = MAGIC;
+            _hdr->bytes = bytes;
+        }
+        return error_c();
+    }
+    auto is_open() const -> bool { return _map!=nullptr;
+    }
+    auto empty() const -> bool { return !_map || _hdr->count==0;
+    }
+    auto size() const -> int { return _map ? _hdr->count : 0;
+    }
+    // the largest block which fits into the ring
+    auto capacity() const -> int { return _map ? _hdr->bytes-sizeof(uint32_t) : 0;
+    }
+    // returns false when the block doesn't fit into the ring
+    auto push(const void* data, int len) -> bool {
+        if (!_map || len<0 || len>capacity()) return false;
+        uint32_t l = len;
+        while (_hdr->bytes-_hdr->used < sizeof(l)+l) {
+            pop();
+            dropped++;
+        }
+        uint32_t pos = (_hdr->head+_hdr->used) % _hdr->bytes;
+        pos = put(pos, &l, sizeof(l));
+        put(pos, data, l);
+        _hdr->used += sizeof(l)+l;
+        _hdr->count++;
+        return true;
+    }
+    // puts the block before the oldest one, a full ring doesn't take it
+    auto push_front(const void* data, int len) -> bool {
+        if (!_map || len<0 || len>capacity()) return false;
+        uint32_t l = len;
+        if (_hdr->bytes-_hdr->used < sizeof(l)+l) return false;
+        uint32_t pos = (_hdr->head+_hdr->bytes-sizeof(l)-l) % _hdr->bytes;
+        put(put(pos, &l, sizeof(l)), data, l);
+        _hdr->head = pos;
+        _hdr->used += sizeof(l)+l;
+        _hdr->count++;
+        return true;
+    }
+    // copies the oldest block to out, false if the ring is empty
+    auto front(std::string& out) const -> bool {
+        if (empty()) return false;
+        uint32_t l;
+        uint32_t pos = get(_hdr->head, &l, sizeof(l));
+        if (l > _hdr->used-sizeof(l)) l = 0; // damaged file
+        out.resize(l);
+        get(pos, out.data(), l);
+        return true;
+    }
+    void pop() {
+        if (empty()) return;
+        uint32_t l;
+        get(_hdr->head, &l, sizeof(l));
+        if (l > _hdr->used-sizeof(l)) { // damaged file
+            reset();
+            return;
+        }
+        _hdr->head = (_hdr->head+sizeof(l)+l) % _hdr->bytes;
+        _hdr->used -= sizeof(l)+l;
+        _hdr->count--;
+    }
+
+    int dropped = 0;
+private:
+    static constexpr uint32_t MAGIC = 0x53504c32; // SPL2
+    struct Header {
+        uint32_t magic;
+        uint32_t bytes; // of the ring after the header
+        uint32_t head;
+        uint32_t used;
+        uint32_t count;
+    };
+    // records wrap around the end of the ring
+    auto put(uint32_t pos, const void* data, uint32_t len) -> uint32_t {
+        uint8_t* ring = _map+sizeof(Header);
+        uint32_t first = std::min(len, _hdr->bytes-pos);
+        std::memcpy(ring+pos, data, first);
+        std::memcpy(ring, static_cast<const uint8_t*>(data)+first, len-first);
+        return (pos+len) % _hdr->bytes;
+    }
+    auto get(uint32_t pos, void* data, uint32_t len) const -> uint32_t {
+        const uint8_t* ring = _map+sizeof(Header);
+        uint32_t first = std::min(len, _hdr->bytes-pos);
+        std::memcpy(data, ring+pos, first);
+        std::memcpy(static_cast<uint8_t*>(data)+first, ring, len-first);
+        return (pos+len) % _hdr->bytes;
+    }
+    void reset() {
+        _hdr->head = 0;
+        _hdr->used = 0;
+        _hdr->count = 0;
+    }
+    void close() {
+        if (_map) munmap(_map, _size);
+        _map = nullptr;
+        _hdr = nullptr;
+        if (_fd!=-1) ::close(_fd);
+        _fd = -1;
+    }
+
+    int _fd = -1;
+    uint8_t* _map = nullptr;
+    size_t _size = 0;
+    Header* _hdr = nullptr;
+};
+
+#endif  //!__SPILL__H__
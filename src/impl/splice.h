@@ -0,0 +1,155 @@
+#ifndef __SPLICE__H__
+#define __SPLICE__H__
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+
+#include "../inc/endpoints.h"
+#include "../log.h"
+
+// Unlike send() splice() to a closed socket has no MSG_NOSIGNAL. SIGPIPE is
+// blocked for the thread while the pipe is drained and the signal raised by
+// EPIPE is consumed, the process disposition stays as it is.
+class SigpipeBlock {
+public:
+    SigpipeBlock() {
+        struct sigaction sa;
+        if (sigaction(SIGPIPE, nullptr, &sa)==0 && sa.sa_handler==SIG_IGN) return;
+        sigemptyset(&_set);
+        sigaddset(&_set, SIGPIPE);
+        sigset_t pending;
+        // a pending signal is blocked already, EPIPE doesn't add one more
+        if (sigpending(&pending)==0 && sigismember(&pending, SIGPIPE)) return;
+        _blocked = pthread_sigmask(SIG_BLOCK, &_set, &_old)==0;
+    }
+    ~SigpipeBlock() {
+        if (!_blocked) return;
+        int ec = errno;
+        if (_epipe) {
+            timespec zero{0,0};
+            while (sigtimedwait(&_set, nullptr, &zero)==-1 && errno==EINTR) {}
+        }
+        pthread_sigmask(SIG_SETMASK, &_old, nullptr);
+        errno = ec;
+    }
+    void check(ssize_t n) { if (n==-1 && errno==EPIPE) _epipe = true;
+    }
+private:
+    sigset_t _set;
+    sigset_t _old;
+    bool _blocked = false;
+    bool _epipe = false;
+};
+
+// Moves stream data from a descriptor to the sink through a pipe by splice(),
+// the data never enters user space. Data the sink doesn't accept is dropped
+// like on write(), so the source is always read to the end and the route
+// never waits for the sink. If the kernel can't splice one of the
+// descriptors (EINVAL) the splicer is disabled, the pipe is emptied by
+// read()/write() and the source reads data as usual then.
+class Splicer {
+public:
+    ~Splicer() {
+        if (_pipe[0]!=-1) close(_pipe[0]);
+        if (_pipe[1]!=-1) close(_pipe[1]);
+    }
+    auto enabled() const -> bool { return _enabled;
+    }
+    // The same as read() of fd: bytes moved from fd, 0 at the end of stream,
+    // -1 with errno. The sink gets results of its writes by spliced() and may
+    // be released there, the caller has to query the sink again before the
+    // next pass.
+    auto pass(int fd, Spliceable* sink) -> int {
+        int out = sink->splice_fd();
+        if (out==-1) {
+            errno = ENOTCONN;
+            return -1;
+        }
+        if (!_enabled) {
+            errno = EINVAL;
+            return -1;
+        }
+        if (_pipe[0]==-1 && !open_pipe()) return -1;
+        ssize_t n = splice(fd, nullptr, _pipe[1], nullptr, capacity, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n<=0) {
+            if (n==-1 && errno==EINVAL) {
+                _enabled = false;
+                log.info()<<"Splice is not supported by descriptors, data is copied"<<Log::endl;
+                errno = EINVAL;
+            }
+            return n;
+        }
+        _pending = n;
+        drain(out, sink);
+        if (_pending) discard();
+        return n;
+    }
+private:
+    static constexpr int capacity = 65536; // default pipe size
+
+    auto open_pipe() -> bool {
+        if (pipe2(_pipe, O_NONBLOCK | O_CLOEXEC)==-1) {
+            int ec = errno;
+            log.warning()<<"No pipe for splice: "<<strerror(ec)<<Log::endl;
+            _enabled = false;
+            errno = ec;
+            return false;
+        }
+        return true;
+    }
+    void drain(int out, Spliceable* sink) {
+        SigpipeBlock sigpipe;
+        while (_pending) {
+            ssize_t n = splice(_pipe[0], nullptr, out, nullptr, _pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            sigpipe.check(n);
+            if (n==-1 && errno==EINVAL) {
+                disable(out, sink, sigpipe);
+                return;
+            }
+            sink->spliced(n);
+            if (n<=0) return;
+            _pending -= n;
+        }
+    }
+    // not accepted data is lost like on write()
+    void discard() {
+        int ec = errno;
+        std::array<char,4096> buffer;
+        while (_pending) {
+            ssize_t n = read(_pipe[0], buffer.data(), std::min<int>(_pending, buffer.size()));
+            if (n<=0) break;
+            _pending -= n;
+        }
+        _pending = 0;
+        errno = ec;
+    }
+    // the rest of the pipe is written as usual
+    void disable(int out, Spliceable* sink, SigpipeBlock& sigpipe) {
+        log.info()<<"Splice is not supported by descriptors, data is copied"<<Log::endl;
+        _enabled = false;
+        std::array<char,4096> buffer;
+        while (_pending) {
+            ssize_t n = read(_pipe[0], buffer.data(), std::min<int>(_pending, buffer.size()));
+            if (n<=0) break;
+            _pending -= n;
+            ssize_t written = write(out, buffer.data(), n);
+            sigpipe.check(written);
+            sink->spliced(written);
+            if (written!=n) break;
+        }
+        errno = EINVAL;
+    }
+
+    int _pipe[2] = {-1, -1};
+    int _pending = 0; // bytes in the pipe
+    bool _enabled = true;
+    inline static Log::Log log {"splice"};
+};
+
+#endif  //!__SPLICE__H__
@@ -5,11 +5,14 @@
 #include <memory>
 #include "../loop.h"
 #include "influx.h"
+#include "influxhttp.h"
+#include "prometheus.h"
+#include "shmshare.h"
 
 //class OStatSet : public OStat {
 //public:
-//    void send(Metric&& metric) override {
-//        for(auto& ostat:ostats) ostat->send(std::forward<Metric>(metric));
+//    void send(const Metric& metric) override {
+//        for(auto& ostat:ostats) ostat->send(metric);
 //    }
 //    void flush() override {
 //        for(auto& ostat:ostats) ostat->flush();
@@ -25,21 +28,29 @@ public:
         _sink = sink;
         _timer->shoot([this](){
             auto it = _stats.before_begin();
-            if (!_sink) return;
-            if (!*_sink) return;
+            if (!_sink || !*_sink) {
+                _timer->stop();
+                return;
+            }
+            auto& sink = **_sink;
+            sink.stamp(std::chrono::system_clock::now());
             for(auto p = _stats.begin();p!=_stats.end();p=std::next(it)) {
                 if (p->expired()) {
                     p = _stats.erase_after(it);
                     continue;
                 }
-                p->lock()->report(*_sink->get());
+                p->lock()->report(sink);
                 it = p;
             }
+            sink.stamp(Metric::Time());
+            sink.flush(); // retry blocks which wait for the output
             if (_stats.empty()) { _timer->stop();
             }
         });
     }
+    // reports are formatted only while there is push output
     void start() {
+        if (!_sink || !*_sink) return;
         if (!_timer->armed()) _timer->arm_periodic(_period);
     }
     void stop() { _timer->stop();
@@ -48,6 +59,22 @@ public:
         _stats.push_front(source);
         start();
     }
+    void share(const std::shared_ptr<StatShare>& shm) {
+        for(auto& stat : _stats) {
+            if (auto p = stat.lock()) p->share(shm);
+        }
+    }
+    void expose(OExpose& out) {
+        auto it = _stats.before_begin();
+        for(auto p = _stats.begin();p!=_stats.end();p=std::next(it)) {
+            if (p->expired()) {
+                p = _stats.erase_after(it);
+                continue;
+            }
+            p->lock()->expose(out);
+            it = p;
+        }
+    }
 private:
     std::unique_ptr<Timer> _timer; 
     std::chrono::nanoseconds _period; 
@@ -70,9 +97,27 @@ public:
             output = std::make_shared<InfluxStream>();
         }
         output->init(out);
+        for(auto& statcall : statcalls) statcall.second.start();
     }
 #ifdef YAML_CONFIG
     auto init_yaml(std::shared_ptr<Writeable> out, YAML::Node cfg) -> error_c override {
+        auto http = cfg ? cfg["http"] : YAML::Node();
+        if (http && http.IsMap()) {
+            std::string address = "127.0.0.1";
+            std::string path = "/write?db=uav&precision=ns";
+            std::string auth;
+            uint16_t port = 8086;
+            if (http["address"]) address = http["address"].as<std::string>();
+            if (http["port"]) port = http["port"].as<int>();
+            if (http["path"]) path = http["path"].as<std::string>();
+            if (http["token"]) auth = "Token "+http["token"].as<std::string>();
+            _http = std::make_shared<InfluxHttp>(_loop->tcp_client("influx"), address, path, auth);
+            _http->on_error([this](const error_c& ec) {on_error(ec);});
+            error_c ec = _http->init(address, port);
+            if (ec) return ec;
+            out = _http;
+        }
+        if (!out) return errno_c(EINVAL,"stats output");
         set_output(out);
         if (cfg && cfg.IsMap()) {
             auto packsize = cfg["packsize"];
@@ -107,13 +152,39 @@ public:
                     }
                 }
             }
+            auto spill = cfg["spill"];
+            if (spill && spill.IsMap() && spill["file"]) {
+                size_t size = 16*1024*1024;
+                if (spill["size"]) size = spill["size"].as<size_t>();
+                error_c ec = output->spill(spill["file"].as<std::string>(), size);
+                if (ec) return ec;
+            }
         }
         return error_c();
     }
 #endif //YAML_CONFIG
 
     void clear_outputs() override {
+        for(auto& statcall : statcalls) statcall.second.stop();
         output.reset();
+        _http.reset();
+    }
+
+    auto expose(uint16_t port, const std::string& address) -> error_c override {
+        _prom = std::make_unique<PromExporter>(_loop->tcp_server("prometheus"), [this](OExpose& out){
+            for(auto& statcall : statcalls) statcall.second.expose(out);
+        });
+        _prom->on_error([this](const error_c& ec) {on_error(ec);});
+        return _prom->init(port, address);
+    }
+
+    auto share(const std::string& name, int capacity) -> error_c override {
+        auto shm = std::make_shared<ShmStatSegment>();
+        error_c ec = shm->init(name, capacity);
+        if (ec) return ec;
+        _shm = std::move(shm);
+        for(auto& statcall : statcalls) statcall.second.share(_shm);
+        return error_c();
     }
 
     void register_report(std::shared_ptr<Stat> source, std::chrono::nanoseconds period) override {
@@ -125,12 +196,16 @@ public:
             timer->on_error([this](const error_c& ec) {on_error(ec);});
             statcall.init(std::move(timer),period,&output);
         }
+        if (_shm) source->share(_shm);
         statcall.add(source);
     }
 private:
     IOLoop* _loop;
     //OStatSet ostats;
     std::shared_ptr<InfluxStream> output;
+    std::shared_ptr<InfluxHttp> _http;
+    std::unique_ptr<PromExporter> _prom;
+    std::shared_ptr<ShmStatSegment> _shm;
     std::map<std::chrono::nanoseconds, PeriodicStatCall> statcalls;
 };
 
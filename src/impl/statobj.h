@@ -1,11 +1,15 @@
 #ifndef __STATOBJ__H__
 #define __STATOBJ__H__
+#include <algorithm>
+#include <cstdint>
 #include <initializer_list>
 #include <map>
 #include <deque>
 #include <string>
 #include <forward_list>
+#include <vector>
 #include "../inc/stat.h"
+#include "../shmstat.h"
 
 class DurationCollector {
 public:
@@ -13,13 +17,37 @@ public:
     void add_metric(Duration interval) {
         count++;
         all += interval;
+        if (_shared_all) {
+            _shared_all->store(all.count(), std::memory_order_relaxed);
+            _shared_count->store(count, std::memory_order_relaxed);
+        }
     }
-    void report(Metric& out, std::string name) {
+    void report(Metric& out, const std::string& name) {
         if (!count) return;
         if (all!=Duration::zero()) out.add_field(name+"_t",all);
         if (count!=0) out.add_field(name+"_cnt",count);
     }
 
+    void expose(OExpose& out, std::string_view name, const std::string& field, std::string_view labels) {
+        out.counter(name, field+"_seconds", labels, std::chrono::duration<double>(all).count());
+        out.counter(name, field+"_count", labels, count);
+    }
+    void share(StatShare& shm, const std::string& prefix, const std::string& field) {
+        _shared_all = shm.slot(prefix+" "+field+"_t", shmstat::DURATION);
+        _shared_count = shm.slot(prefix+" "+field+"_cnt", shmstat::COUNTER);
+        if (!_shared_all || !_shared_count) {
+            unshare(shm);
+            return;
+        }
+        _shared_all->store(all.count(), std::memory_order_relaxed);
+        _shared_count->store(count, std::memory_order_relaxed);
+    }
+    void unshare(StatShare& shm) {
+        shm.release(_shared_all);
+        shm.release(_shared_count);
+        _shared_all = _shared_count = nullptr;
+    }
+
     class Measure {
     public:
         using Clock = std::chrono::steady_clock;
@@ -35,57 +63,213 @@ public:
     }
     Duration all = Duration::zero();
     int count = 0;
+private:
+    std::atomic<int64_t>* _shared_all = nullptr;
+    std::atomic<int64_t>* _shared_count = nullptr;
 };
 
 class StatDurations : public Stat {
 public:
     StatDurations(std::string name):_name(std::move(name)) {}
-    void report(OStat& out) override {
-        Metric meter(_name);
-        for(auto& tag: tags) {
-            meter.add_tag(tag.first, tag.second);
+    ~StatDurations() override {
+        if (_share) {
+            for(auto& item : time) item.second.unshare(*_share);
         }
+    }
+    void report(OStat& out) override {
+        auto& meter = metric(_name);
         report(meter);
-        out.send(std::move(meter));
+        out.send(meter);
     }
     void report(Metric& meter) {
         for(auto& item : time) {
             item.second.report(meter,item.first);
         }
     }
+    void expose(OExpose& out) override {
+        for(auto& item : time) {
+            item.second.expose(out,_name,item.first,labels());
+        }
+    }
+    void share(std::shared_ptr<StatShare> shm) override {
+        _share = std::move(shm);
+        for(auto& item : time) item.second.share(*_share,prefix(_name),item.first);
+    }
+    // collector which is shared if the stat is, prefer it to time[name]
+    auto collector(const std::string& name) -> DurationCollector& {
+        auto it = time.find(name);
+        if (it!=time.end()) return it->second;
+        auto& ret = time[name];
+        if (_share) ret.share(*_share,prefix(_name),name);
+        return ret;
+    }
     std::map<std::string,DurationCollector> time;
 private:
     std::string _name;
+    std::shared_ptr<StatShare> _share;
 };
 
+// Counters are addressed by handles resolved once, so the hot path is an
+// index into a flat array. "read" and "write" are registered in every set,
+// their handles are constants.
 class StatCounters : public Stat {
 public:
-    StatCounters(std::string name):_name(std::move(name)) {}
-    void report(OStat& out) override {
-        Metric meter(_name);
-        for(auto& tag: tags) {
-            meter.add_tag(tag.first, tag.second);
+    using Handle = std::size_t;
+    enum : Handle { READ, WRITE };
+    StatCounters(std::string name):_name(std::move(name)) {
+        handle("read");
+        handle("write");
+    }
+    ~StatCounters() override {
+        if (_share) {
+            for(auto& counter : _counters) _share->release(counter.shared);
         }
+    }
+    void report(OStat& out) override {
+        auto& meter = metric(_name);
         report(meter);
-        out.send(std::move(meter));
+        out.send(meter);
     }
     void report(Metric& meter) {
-        for(auto& item : values) {
-            if (item.second.second) {
-                meter.add_field(item.first, item.second.first);
-                item.second.second = false;
+        for(auto index : _order) {
+            auto& counter = _counters[index];
+            if (counter.changed) {
+                meter.add_field(_names[index], static_cast<long long int>(counter.value));
+                counter.changed = false;
             }
         }
     }
+    void expose(OExpose& out) override {
+        expose(out,_name,labels());
+    }
+    void expose(OExpose& out, std::string_view name, std::string_view labels) {
+        for(auto index : _order) {
+            out.counter(name, _names[index], labels, _counters[index].value);
+        }
+    }
+    void share(std::shared_ptr<StatShare> shm) override {
+        _share = std::move(shm);
+        for(Handle i=0;i<_counters.size();i++) share(i);
+    }
+    // registers the counter, the handle is valid while the object exists
+    auto handle(const std::string& name) -> Handle {
+        for(Handle i=0;i<_names.size();i++) {
+            if (_names[i]==name) return i;
+        }
+        Handle index = _names.size();
+        _names.push_back(name);
+        _counters.emplace_back();
+        auto pos = std::upper_bound(_order.begin(),_order.end(),name,[this](const std::string& n, Handle h){ return n<_names[h]; });
+        _order.insert(pos,index);
+        if (_share) share(index);
+        return index;
+    }
+    void add(Handle h, int64_t value) {
+        auto& counter = _counters[h];
+        counter.value += value;
+        counter.changed = true;
+        if (counter.shared) counter.shared->store(counter.value, std::memory_order_relaxed);
+    }
     void add(const std::string& name, int value) {
-        auto& v = values[name];
-        v.first += value;
-        v.second = true;
+        add(handle(name), value);
     }
+    auto name() const -> const std::string& { return _name;
+    }
+
+private:
+    struct Counter {
+        int64_t value = 0;
+        bool changed = false;
+        std::atomic<int64_t>* shared = nullptr;
+    };
+    void share(Handle h) {
+        auto& counter = _counters[h];
+        if (counter.shared) return;
+        counter.shared = _share->slot(prefix(_name)+" "+_names[h], shmstat::COUNTER);
+        if (counter.shared) counter.shared->store(counter.value, std::memory_order_relaxed);
+    }
+    std::shared_ptr<StatShare> _share;
+    std::vector<Counter> _counters;
+    std::vector<std::string> _names;
+    std::vector<Handle> _order; // report fields sorted by name
+    std::string _name;
+};
 
+// Fixed bucket histogram. Bucket i counts values up to edges[i], the last
+// one counts the rest. Counts are cumulative, fields are reported as
+// <name>_le_<edge> and <name>_inf when something was added. Exposition
+// is a histogram family with the sum of values.
+class StatHistogram {
+public:
+    StatHistogram(const std::string& name, std::initializer_list<int64_t> edges):_name(name),_edges(edges),_counts(_edges.size()+1) {
+        for(auto edge : _edges) _names.push_back(name+"_le_"+std::to_string(edge));
+        _names.push_back(name+"_inf");
+    }
+    void add(int64_t value) {
+        size_t i = std::lower_bound(_edges.begin(),_edges.end(),value)-_edges.begin();
+        _counts[i]++;
+        _sum += value;
+        _changed = true;
+    }
+    void report(Metric& meter) {
+        if (!_changed) return;
+        for(size_t i=0;i<_counts.size();i++) meter.add_field(_names[i], _counts[i]);
+        _changed = false;
+    }
+    void expose(OExpose& out, std::string_view name, std::string_view labels) {
+        out.histogram(name, _name, labels, _edges, _counts, _sum);
+    }
 private:
-    std::map<std::string,std::pair<int,bool>> values;
     std::string _name;
+    std::vector<int64_t> _edges;
+    std::vector<int64_t> _counts;
+    std::vector<std::string> _names;
+    double _sum = 0;
+    bool _changed = false;
+};
+
+// Counters of a packet stream with histograms of frame size, inter-arrival
+// gap and jitter (difference of consecutive gaps), gap and jitter are in
+// microseconds. Radio buffering and USB serial latency timer show up as
+// peaks in gap histogram, bursty sources as zero gaps with large jitter.
+class FrameCounters : public StatCounters {
+public:
+    using Clock = std::chrono::steady_clock;
+    FrameCounters(std::string name):StatCounters(std::move(name)) {}
+    void frame(int len) {
+        auto now = Clock::now();
+        _size.add(len);
+        if (_last!=Clock::time_point()) {
+            int64_t gap = std::chrono::duration_cast<std::chrono::microseconds>(now-_last).count();
+            _gap.add(gap);
+            if (_last_gap>=0) _jitter.add(gap>_last_gap ? gap-_last_gap : _last_gap-gap);
+            _last_gap = gap;
+        }
+        _last = now;
+    }
+    void report(OStat& out) override {
+        auto& meter = metric(name());
+        report(meter);
+        out.send(meter);
+    }
+    void report(Metric& meter) {
+        StatCounters::report(meter);
+        _size.report(meter);
+        _gap.report(meter);
+        _jitter.report(meter);
+    }
+    void expose(OExpose& out) override {
+        StatCounters::expose(out);
+        _size.expose(out,name(),labels());
+        _gap.expose(out,name(),labels());
+        _jitter.expose(out,name(),labels());
+    }
+private:
+    StatHistogram _size {"size",{16,32,64,128,256,512,1024}};
+    StatHistogram _gap {"gap_us",{100,1000,2000,5000,10000,20000,50000,100000,200000,500000,1000000}};
+    StatHistogram _jitter {"jitter_us",{100,500,1000,2000,5000,10000,20000,50000,100000}};
+    Clock::time_point _last;
+    int64_t _last_gap = -1;
 };
 
 class StatEvents : public Stat {
@@ -96,16 +280,25 @@ public:
         if (name.empty()) name = "ev_"+std::to_string(index);
         _events.emplace_front(_name);
         auto& meter = _events.front();
+        meter.time(std::chrono::system_clock::now());
         meter.add_field(name, ++_counter[index]);
-        for(auto& tag: tags) {
+        for(auto& tag: tags()) {
             meter.add_tag(tag.first, tag.second);
         }
         while (_events.size()>max_events) _events.pop_back();
         return _events.front();
     }
+    void expose(OExpose& out) override {
+        for(auto& counter : _counter) {
+            auto& name = _names[counter.first];
+            if (name.empty()) { out.counter(_name, "ev_"+std::to_string(counter.first), labels(), counter.second);
+            } else {            out.counter(_name, name, labels(), counter.second);
+            }
+        }
+    }
     void report(OStat& out) override {
         while(_events.size()) {
-            out.send(std::move(_events.back()));
+            out.send(_events.back());
             _events.pop_back();
         }
     }
@@ -11,15 +11,16 @@ using namespace std::chrono_literals;
 #include "../err.h"
 #include "../loop.h"
 #include "../log.h"
+#include "splice.h"
 #include "statobj.h"
 #include "yaml.h"
 
 class TcpClientImpl;
 
-class TCPClientStream: public Client {
+class TCPClientStream: public Client, public Spliceable {
 public:
     TCPClientStream(const std::string& name, int fd, std::shared_ptr<StatCounters> cnt):_name(name), _fd(fd), _cnt(std::move(cnt)) {
-        _cnt->tags.push_front({"endpoint",name});
+        _cnt->add_tag({"endpoint",name});
     }
     auto write(const void* buf, int len) -> int override {
         if (!_is_writeable) return 0;
@@ -31,14 +32,27 @@ public:
                 on_error(ret, "tcp client write");
             }
         } else {
-            _cnt->add("write",n);
+            _cnt->add(StatCounters::WRITE,n);
         }
         return n;
     }
 
     void on_read(void* buf, int len) override {
         Readable::on_read(buf,len);
-        _cnt->add("read",len);
+        _cnt->add(StatCounters::READ,len);
+    }
+
+    auto splice_fd() -> int override { return _fd;
+    }
+    void spliced(int n) override {
+        if (n==-1) {
+            errno_c ret;
+            if (ret != std::error_condition(std::errc::resource_unavailable_try_again)) {
+                on_error(ret, "tcp client splice");
+            }
+        } else {
+            _cnt->add(StatCounters::WRITE,n);
+        }
     }
 
     auto get_peer_name() -> const std::string& override {
@@ -255,6 +269,7 @@ public:
     }
 
     void cleanup() override {
+        if (auto client = _client.lock()) client->on_close();
         if (_fd != -1) {
             on_error(to_errno_c(close(_fd),"close"));
             _fd = -1;
@@ -272,6 +287,10 @@ public:
 
     auto epollIN() -> int override {
         if (error()) return HANDLED;
+        if (_splicer.enabled()) {
+            int ret = splice_in();
+            if (ret!=NOT_HANDLED) return ret;
+        }
         while(true) {
             int sz;
             error_c ret = to_errno_c(ioctl(_fd, FIONREAD, &sz),"tcp ioctl");
@@ -303,9 +322,30 @@ public:
         return HANDLED;
     }
 
+    // unfiltered route to one stream endpoint, the data stays in the kernel
+    auto splice_in() -> int {
+        while(true) {
+            auto client = _client.lock();
+            Spliceable* sink = client ? client->splice_sink() : nullptr;
+            if (!sink) return NOT_HANDLED;
+            int n = _splicer.pass(_fd, sink);
+            if (!_exists) return STOP;
+            if (n>0) {
+                client->_cnt->add(StatCounters::READ,n);
+                continue;
+            }
+            if (n==-1) {
+                errno_c ret;
+                if (ret == std::error_condition(std::errc::resource_unavailable_try_again)) return HANDLED;
+            }
+            return NOT_HANDLED; // recv() reports the end or the error
+        }
+    }
+
     auto epollOUT() -> int override {
         auto client = cli();
         if (!_exists) return STOP;
+        if (client) client->writeable();
         return HANDLED;
     }
 
@@ -341,7 +381,7 @@ public:
         if (!ret) {
             auto stat = std::make_shared<StatCounters>("tcpcli");
             if (stat_period.count()) {
-                stat->tags = stat_tags;
+                stat->set_tags(stat_tags);
                 _loop->stats()->register_report(stat, stat_period);
             }
             ret = std::make_shared<TCPClientStream>(peer_name,_fd, std::move(stat));
@@ -393,6 +433,7 @@ private:
     std::unique_ptr<AvahiGroup> _group;
     std::unique_ptr<Timer> _timer;
     std::weak_ptr<TCPClientStream> _client;
+    Splicer _splicer;
     std::shared_ptr<ServiceEvents> _service_pollable;
     std::chrono::nanoseconds stat_period = 1s;
     std::forward_list<std::pair<std::string,std::string>> stat_tags;
@@ -10,16 +10,17 @@ using namespace std::chrono_literals;
 #include "../err.h"
 #include "../loop.h"
 #include "../log.h"
+#include "splice.h"
 #include "statobj.h"
 #include "yaml.h"
 
-class TCPServerStream : public Client, public IOPollable {
+class TCPServerStream : public Client, public Spliceable, public IOPollable {
 public:
     TCPServerStream(const std::string& name, int fd, IOLoopSvc* loop, std::chrono::nanoseconds stat_period, std::forward_list<std::pair<std::string,std::string>>& tags):IOPollable(name), _fd(fd),_poll(loop->poll()) {
         _poll->add(_fd, EPOLLIN | EPOLLOUT | EPOLLET, this);
         _cnt = std::make_shared<StatCounters>("tcpsvr");
-        _cnt->tags = tags;
-        _cnt->tags.push_front({"endpoint",name});
+        _cnt->set_tags(tags);
+        _cnt->add_tag({"endpoint",name});
         if (stat_period.count()) {
             loop->stats()->register_report(_cnt, stat_period);
         }
@@ -39,6 +40,10 @@ public:
         return errno_c(ec,"socket error");
     }
     auto epollIN() -> int override {
+        if (_splicer.enabled()) {
+            int ret = splice_in();
+            if (ret!=NOT_HANDLED) return ret;
+        }
         while(true) {
             int sz;
             errno_c ret = to_errno_c(ioctl(_fd, FIONREAD, &sz),"tcp ioctl");
@@ -68,12 +73,29 @@ public:
                 }
                 log.debug()<<"on_read"<<Log::endl;
                 on_read(buffer, n);
-                _cnt->add("read",n);
+                _cnt->add(StatCounters::READ,n);
                 if (!_exists) return STOP;
             }
         }
         return HANDLED;
     }
+    // unfiltered route to one stream endpoint, the data stays in the kernel
+    auto splice_in() -> int {
+        while(Spliceable* sink = splice_sink()) {
+            int n = _splicer.pass(_fd, sink);
+            if (!_exists) return STOP;
+            if (n>0) {
+                _cnt->add(StatCounters::READ,n);
+                continue;
+            }
+            if (n==-1) {
+                errno_c ret;
+                if (ret == std::error_condition(std::errc::resource_unavailable_try_again)) return HANDLED;
+            }
+            break; // recv() reports the end or the error
+        }
+        return NOT_HANDLED;
+    }
     auto epollOUT() -> int override {
         writeable();
         if (!_exists) return STOP;
@@ -107,6 +129,23 @@ public:
             _fd = -1;
         }
     }
+    auto splice_fd() -> int override { return _fd;
+    }
+    void spliced(int n) override {
+        if (n==-1) {
+            errno_c ret;
+            if (ret != std::error_condition(std::errc::resource_unavailable_try_again)) {
+                on_error(ret, "tcp splice");
+                if (ret==std::error_condition(std::errc::broken_pipe)) {
+                    _poll->del(_fd,this);
+                    cleanup();
+                    on_close(); // the stream may be released here
+                }
+            }
+        } else {
+            _cnt->add(StatCounters::WRITE,n);
+        }
+    }
     auto write(const void* buf, int len) -> int override {
         if (!_is_writeable) return 0;
         ssize_t n = send(_fd, buf, len, MSG_NOSIGNAL);
@@ -114,23 +153,24 @@ public:
         if (n==-1) {
             errno_c ret;
             if (ret != std::error_condition(std::errc::resource_unavailable_try_again)) {
+                on_error(ret, "tcp send");
                 if (ret==std::error_condition(std::errc::broken_pipe)) {
                     _poll->del(_fd,this);
                     cleanup();
-                    on_close();
+                    on_close(); // the stream may be released here
+                    return n;
                 }
-                on_error(ret, "tcp send");
             }
         } else {
-            _cnt->add("write",n);
+            _cnt->add(StatCounters::WRITE,n);
         }
         return n;
     }
 private:
     int _fd = -1;
     Poll* _poll;
-    bool _is_writeable = true;
     bool _exists = true;
+    Splicer _splicer;
     inline static Log::Log log {"tcpstream"};
     std::shared_ptr<StatCounters> _cnt;
     friend class TcpServerImpl;
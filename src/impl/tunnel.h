@@ -0,0 +1,426 @@
+#ifndef __TUNNEL__H__
+#define __TUNNEL__H__
+#include <cstring>
+#include <map>
+#include <vector>
+#include <chrono>
+using namespace std::chrono_literals;
+
+#include "../err.h"
+#include "../loop.h"
+#include "../log.h"
+#include "statobj.h"
+#include "yaml.h"
+
+/*
+Tunnel frame
+ 0      magic
+ 1      type: DATA or NAME
+ 2      stream id in sender's numbering
+ 3..4   payload length, big endian
+ 5..6   sequence number of DATA frame in the stream, big endian
+ 7..    payload: packet of the stream or name of the stream
+*/
+class TunnelFrame {
+public:
+    enum { MAGIC = 0xA7, HEADER = 7, MAX_PAYLOAD = 0xFFFF };
+    enum Type : uint8_t { DATA = 0, NAME = 1 };
+    static void header(uint8_t* buf, Type type, uint8_t id, uint16_t len, uint16_t seq) {
+        buf[0] = MAGIC;
+        buf[1] = type;
+        buf[2] = id;
+        buf[3] = len >> 8;
+        buf[4] = len & 0xFF;
+        buf[5] = seq >> 8;
+        buf[6] = seq & 0xFF;
+    }
+    static auto length(const uint8_t* buf) -> int { return (buf[3]<<8) | buf[4];
+    }
+    static auto seq(const uint8_t* buf) -> uint16_t { return (buf[5]<<8) | buf[6];
+    }
+};
+
+class TunnelLink;
+
+class TunnelStream: public Client {
+public:
+    TunnelStream(std::string name, uint8_t id, TunnelLink* link):_name(std::move(name)),_id(id),_link(link) {}
+    auto write(const void* buf, int len) -> int override;
+    auto get_peer_name() -> const std::string& override {
+        return _name;
+    }
+    void on_read(void* buf, int len) override {
+        Readable::on_read(buf,len);
+    }
+    void on_close() override {
+        _link = nullptr;
+        _is_writeable = false;
+        Closeable::on_close();
+    }
+
+    std::string _name;
+    uint8_t _id;
+    uint16_t _seq = 0;
+    uint16_t _rx_seq = 0;
+    bool _rx_started = false;
+    TunnelLink* _link;
+
+    friend class TunnelLink;
+};
+
+class TunnelImpl;
+
+// One connection of the tunnel transport with the set of streams multiplexed over it
+class TunnelLink {
+public:
+    TunnelLink(TunnelImpl* tunnel, std::shared_ptr<Writeable> out, std::shared_ptr<Client> peer, bool datagram);
+    ~TunnelLink() { close();
+    }
+    // closes streams, a closed link doesn't touch the transport and the tunnel
+    void close() {
+        if (_closed) return;
+        _closed = true;
+        for(auto& s : _streams) {
+            if (auto stream = s.lock()) stream->on_close();
+        }
+    }
+    // the transport client may outlive the link
+    void detach() {
+        if (!_peer) return;
+        _peer->on_read(nullptr);
+        _peer->writeable(nullptr);
+        _peer->on_close(nullptr);
+    }
+    void start();
+    void announce();
+    void read(const void* buf, int len);
+    auto send(TunnelFrame::Type type, uint8_t id, uint16_t seq, const void* buf, int len) -> int;
+    void flush();
+
+private:
+    void frame(const uint8_t* buf);
+    auto stream(const std::string& name) -> std::shared_ptr<TunnelStream>;
+
+    TunnelImpl* _tunnel;
+    std::shared_ptr<Writeable> _out;
+    std::shared_ptr<Client> _peer;
+    bool _datagram;
+    bool _started = false;
+    bool _closed = false;
+    std::vector<std::weak_ptr<TunnelStream>> _streams; // index is the local stream id
+    std::map<uint8_t, std::weak_ptr<TunnelStream>> _remote; // remote stream id -> stream
+    std::vector<uint8_t> _frame;
+    std::vector<uint8_t> _input;
+    std::vector<uint8_t> _pending;
+    static constexpr int max_pending = 65536;
+    friend class TunnelImpl;
+    friend class TunnelStream;
+};
+
+class TunnelImpl : public Tunnel {
+public:
+    TunnelImpl(std::string name, IOLoopSvc* loop):_name(std::move(name)),_loop(loop),_timer(loop->timer()) {
+        _cnt = std::make_shared<StatCounters>("tunnel");
+        _cnt->add_tag({"endpoint",_name});
+        _tx = _cnt->handle("tx");
+        _rx = _cnt->handle("rx");
+        _timer->on_error([this](error_c& ec){ on_error(ec,_name);});
+        _timer->shoot([this](){
+            // links closed meanwhile stay alive till the end of the loop turn
+            std::vector<TunnelLink*> links;
+            for(auto& link : _links) links.push_back(link.second.get());
+            for(auto* link : links) {
+                if (link->_closed) continue;
+                if (link->_started) { link->announce();
+                } else { link->start();
+                }
+                if (!_exists) return;
+            }
+        });
+    }
+    ~TunnelImpl() override {
+        _exists = false;
+        release_links();
+    }
+
+#ifdef YAML_CONFIG
+    auto init_yaml(YAML::Node cfg) -> error_c override {
+        auto statcfg = cfg["stat"];
+        if (statcfg && statcfg.IsMap()) {
+            auto period = duration(statcfg["period"]);
+            if (period.count()) {
+                _loop->stats()->register_report(_cnt, period);
+            }
+            auto tags = statcfg["tags"];
+            if (tags && tags.IsMap()) {
+                for(auto tag : tags) {
+                    _cnt->add_tag(std::make_pair(tag.first.as<std::string>(),tag.second.as<std::string>()));
+                }
+            }
+        }
+        std::vector<std::string> streams;
+        auto names = cfg["streams"];
+        if (names) {
+            if (names.IsScalar()) { streams.push_back(names.as<std::string>());
+            } else if (names.IsSequence()) { streams = names.as<std::vector<std::string>>();
+            }
+        }
+        bool sequence = false;
+        if (cfg["sequence"]) sequence = cfg["sequence"].as<bool>();
+        if (!cfg["transport"]) return errno_c(ENOTSUP,"tunnel transport");
+        auto type = cfg["transport"].as<std::string>();
+        std::shared_ptr<StreamSource> transport;
+        if (type=="tcp-client") {        transport = _loop->tcp_client(_name);
+        } else if (type=="tcp-server") { transport = _loop->tcp_server(_name);
+        } else if (type=="udp-client") { transport = _loop->udp_client(_name);
+        } else if (type=="udp-server") { transport = _loop->udp_server(_name);
+        } else return errno_c(ENOTSUP,"tunnel transport "+type);
+        error_c ret = init(transport, streams, sequence);
+        if (ret) return ret;
+        return transport->init_yaml(cfg["link"]);
+    }
+#endif //YAML_CONFIG
+
+    auto init(std::shared_ptr<StreamSource> transport, const std::vector<std::string>& streams, bool sequence) -> error_c override {
+        if (streams.size()>255) return errno_c(EINVAL,"tunnel streams number");
+        _transport = std::move(transport);
+        _local = streams;
+        _sequence = sequence;
+        _transport->on_error([this](error_c& ec){ on_error(ec,_name);});
+        auto udp = std::dynamic_pointer_cast<UdpClient>(_transport);
+        _datagram = udp || std::dynamic_pointer_cast<UdpServer>(_transport);
+        if (udp) {
+            // udp client sends all datagrams to the single peer by itself,
+            // streams are created by timer after the endpoint setup is complete
+            _links[nullptr] = std::make_unique<TunnelLink>(this, udp, nullptr, true);
+        }
+        _transport->on_connect([this](std::shared_ptr<Client> cli, const std::string& name){
+            if (auto it = _links.find(nullptr); it!=_links.end()) {
+                auto* link = it->second.get();
+                cli->on_read([link](void* buf, int len){ link->read(buf,len); });
+                _peers[cli.get()] = cli;
+                cli->on_close([this, cli = cli.get()](){ _peers.erase(cli); });
+                return;
+            }
+            // the tunnel connects to one peer router, the new link replaces previous one
+            release_links();
+            if (!_exists) return;
+            auto& link = _links[cli.get()];
+            link = std::make_unique<TunnelLink>(this, cli, cli, _datagram);
+            cli->on_read([link = link.get()](void* buf, int len){ link->read(buf,len); });
+            cli->writeable([link = link.get()](){ link->flush(); });
+            cli->on_close([this, cli = cli.get()](){
+                log.info()<<"Tunnel "<<_name<<" link closed"<<Log::endl;
+                auto it = _links.find(cli);
+                if (it==_links.end()) return;
+                auto closed = std::move(it->second);
+                _links.erase(it);
+                release(std::move(closed));
+            });
+            cli->on_error([this](error_c& ec){ on_error(ec,_name);});
+            log.info()<<"Tunnel "<<_name<<" link to "<<name<<" established"<<Log::endl;
+            link->start();
+        });
+        if (_datagram) {
+            // datagrams with stream names may be lost, so repeat them
+            itimerspec ts{{1,0},{0,1}};
+            return _timer->arm(&ts,0);
+        }
+        return error_c();
+    }
+
+    auto exists() -> bool { return _exists; }
+
+    // The transport closes a link inside its write or read called by the
+    // link itself, so the link is released after the loop turn
+    void release(std::unique_ptr<TunnelLink> link) {
+        std::shared_ptr<TunnelLink> closed(std::move(link));
+        closed->close();
+        _loop->defer([closed](){ closed->detach(); });
+    }
+    void release_links() {
+        std::vector<std::unique_ptr<TunnelLink>> links;
+        for(auto& link : _links) links.push_back(std::move(link.second));
+        _links.clear();
+        for(auto& link : links) release(std::move(link));
+    }
+
+    std::string _name;
+    IOLoopSvc* _loop;
+    std::shared_ptr<StreamSource> _transport;
+    std::vector<std::string> _local;
+    bool _sequence = false;
+    bool _datagram = false;
+    bool _exists = true;
+    std::unique_ptr<Timer> _timer;
+    std::map<Client*, std::unique_ptr<TunnelLink>> _links;
+    std::map<Client*, std::shared_ptr<Client>> _peers;
+    std::shared_ptr<StatCounters> _cnt;
+    StatCounters::Handle _tx;
+    StatCounters::Handle _rx;
+    inline static Log::Log log {"tunnel"};
+    friend class TunnelLink;
+};
+
+inline auto TunnelStream::write(const void* buf, int len) -> int {
+    if (!_link || _link->_closed) return -1;
+    if (len > TunnelFrame::MAX_PAYLOAD) return -1;
+    int ret = _link->send(TunnelFrame::DATA, _id, _seq++, buf, len);
+    if (ret < 0) return ret;
+    return len;
+}
+
+inline TunnelLink::TunnelLink(TunnelImpl* tunnel, std::shared_ptr<Writeable> out, std::shared_ptr<Client> peer, bool datagram):
+    _tunnel(tunnel),_out(std::move(out)),_peer(std::move(peer)),_datagram(datagram) {
+    _frame.reserve(TunnelFrame::HEADER+1024);
+}
+
+inline void TunnelLink::start() {
+    _started = true;
+    for(auto& name : _tunnel->_local) {
+        stream(name);
+        if (_closed || !_tunnel->exists()) return;
+    }
+}
+
+inline void TunnelLink::announce() {
+    for(std::size_t i=0;i<_streams.size();i++) {
+        if (auto str = _streams[i].lock()) send(TunnelFrame::NAME, str->_id, 0, str->_name.data(), str->_name.size());
+        if (_closed) return;
+    }
+}
+
+// find or create the stream with the name
+inline auto TunnelLink::stream(const std::string& name) -> std::shared_ptr<TunnelStream> {
+    for(auto& s : _streams) {
+        auto str = s.lock();
+        if (str && str->_name==name) return str;
+    }
+    if (_streams.size()>255) return std::shared_ptr<TunnelStream>();
+    auto str = std::make_shared<TunnelStream>(name, _streams.size(), this);
+    _streams.push_back(str);
+    send(TunnelFrame::NAME, str->_id, 0, name.data(), name.size());
+    if (_closed) return std::shared_ptr<TunnelStream>(); // the stream is closed with the link
+    str->on_error([this](error_c& ec){ _tunnel->on_error(ec,_tunnel->_name);});
+    str->writeable();
+    _tunnel->on_connect(str, name);
+    return str;
+}
+
+inline auto TunnelLink::send(TunnelFrame::Type type, uint8_t id, uint16_t seq, const void* buf, int len) -> int {
+    if (_closed) return -1;
+    _frame.resize(TunnelFrame::HEADER+len);
+    TunnelFrame::header(_frame.data(), type, id, len, seq);
+    memcpy(_frame.data()+TunnelFrame::HEADER, buf, len);
+    if (!_datagram && !_pending.empty()) {
+        if (int(_pending.size()+_frame.size()) > max_pending) {
+            _tunnel->_cnt->add("drop",1);
+            return -1;
+        }
+        _pending.insert(_pending.end(),_frame.begin(),_frame.end());
+        return len;
+    }
+    int ret = _out->write(_frame.data(), _frame.size());
+    if (_closed) return -1; // the transport is closed by the write
+    if (ret==int(_frame.size())) {
+        _tunnel->_cnt->add(_tunnel->_tx,_frame.size());
+        return len;
+    }
+    if (_datagram) return -1;
+    // keep the rest of the frame to not break the stream
+    if (ret<0) ret = 0;
+    _tunnel->_cnt->add(_tunnel->_tx,ret);
+    _pending.insert(_pending.end(),_frame.begin()+ret,_frame.end());
+    return len;
+}
+
+inline void TunnelLink::flush() {
+    if (_closed || _pending.empty()) return;
+    int ret = _out->write(_pending.data(), _pending.size());
+    if (_closed || ret<=0) return;
+    _tunnel->_cnt->add(_tunnel->_tx,ret);
+    _pending.erase(_pending.begin(), _pending.begin()+ret);
+}
+
+inline void TunnelLink::read(const void* buf, int len) {
+    if (_closed) return;
+    _tunnel->_cnt->add(_tunnel->_rx,len);
+    const auto* ptr = static_cast<const uint8_t*>(buf);
+    if (_datagram || _input.empty()) {
+        // parse in place and keep the tail only
+        while (len>=TunnelFrame::HEADER) {
+            if (ptr[0]!=TunnelFrame::MAGIC) {
+                _tunnel->_cnt->add("badframe",1);
+                return;
+            }
+            int size = TunnelFrame::HEADER + TunnelFrame::length(ptr);
+            if (size>len) break;
+            frame(ptr);
+            if (_closed || !_tunnel->exists()) return;
+            ptr+=size;
+            len-=size;
+        }
+        if (_datagram) {
+            if (len) _tunnel->_cnt->add("badframe",1);
+            return;
+        }
+        _input.assign(ptr,ptr+len);
+        return;
+    }
+    _input.insert(_input.end(),ptr,ptr+len);
+    std::size_t pos = 0;
+    while (_input.size()-pos >= TunnelFrame::HEADER) {
+        const uint8_t* f = _input.data()+pos;
+        if (f[0]!=TunnelFrame::MAGIC) {
+            _tunnel->_cnt->add("badframe",1);
+            _input.clear();
+            return;
+        }
+        std::size_t size = TunnelFrame::HEADER + TunnelFrame::length(f);
+        if (size > _input.size()-pos) break;
+        frame(f);
+        if (_closed || !_tunnel->exists()) return;
+        pos+=size;
+    }
+    _input.erase(_input.begin(),_input.begin()+pos);
+}
+
+inline void TunnelLink::frame(const uint8_t* buf) {
+    int len = TunnelFrame::length(buf);
+    uint8_t id = buf[2];
+    auto* payload = const_cast<uint8_t*>(buf+TunnelFrame::HEADER);
+    if (buf[1]==TunnelFrame::NAME) {
+        std::string name((const char*)payload, len);
+        auto& remote = _remote[id];
+        auto str = remote.lock();
+        if (str && str->_name==name) return;
+        str = stream(name);
+        remote = str;
+        return;
+    }
+    if (buf[1]!=TunnelFrame::DATA) {
+        _tunnel->_cnt->add("badframe",1);
+        return;
+    }
+    auto it = _remote.find(id);
+    if (it==_remote.end()) {
+        _tunnel->_cnt->add("noname",1);
+        return;
+    }
+    auto str = it->second.lock();
+    if (!str) return;
+    if (_tunnel->_sequence) {
+        uint16_t seq = TunnelFrame::seq(buf);
+        auto diff = int16_t(seq - str->_rx_seq);
+        if (str->_rx_started && diff<0) {
+            _tunnel->_cnt->add("late",1);
+            return;
+        }
+        if (str->_rx_started && diff>0) _tunnel->_cnt->add("lost",diff);
+        str->_rx_seq = seq+1;
+        str->_rx_started = true;
+    }
+    str->on_read(payload, len);
+}
+
+#endif  //!__TUNNEL__H__
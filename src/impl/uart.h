@@ -17,6 +17,7 @@ using namespace std::chrono_literals;
 #include "../log.h"
 
 #include "fd.h"
+#include "splice.h"
 #include "statobj.h"
 #include "yaml.h"
 
@@ -54,7 +55,7 @@ std::map<int, speed_t> bauds = {
     {4000000,B4000000}
 };
 
-class UARTClient: public Client {
+class UARTClient: public Client, public Spliceable {
 public:
     UARTClient(const std::string& name, int fd, std::shared_ptr<StatCounters>& cnt):_name(name), _fd(fd), _cnt(cnt) {}
     auto write(const void* buf, int len) -> int override {
@@ -67,10 +68,22 @@ public:
                 on_error(ret, "uart write");
             }
         } else {
-            _cnt->add("write",n);
+            _cnt->add(StatCounters::WRITE,n);
         }
         return n;
     }
+    auto splice_fd() -> int override { return _fd;
+    }
+    void spliced(int n) override {
+        if (n==-1) {
+            errno_c ret;
+            if (ret != std::error_condition(std::errc::resource_unavailable_try_again)) {
+                on_error(ret, "uart splice");
+            }
+        } else {
+            _cnt->add(StatCounters::WRITE,n);
+        }
+    }
     auto get_peer_name() -> const std::string& override {
         return _name;
     }
@@ -143,7 +156,7 @@ public:
                 for(auto tag : tags) {
                     std::string key = tag.first.as<std::string>();
                     std::string val = tag.second.as<std::string>();
-                    cnt->tags.push_front(std::make_pair(key,val));
+                    cnt->add_tag(std::make_pair(key,val));
                 }
             }
             _stat->register_report(cnt, period);
@@ -251,6 +264,10 @@ public:
     }
 
     auto epollIN() -> int override {
+        if (_splicer.enabled()) {
+            int ret = splice_in();
+            if (ret!=NOT_HANDLED) return ret;
+        }
         int n = 1024;
         while(n==1024) {
             std::array<char,1024> buffer;
@@ -267,7 +284,7 @@ public:
                 log.warning()<<"UART read returns 0 bytes"<<Log::endl;
                 break;
             }
-            cnt->add("read",n);
+            cnt->add(StatCounters::READ,n);
             if (auto client = cli()) {
                 if (!_exists) return STOP;
                 client->on_read(buffer.data(), n);
@@ -277,6 +294,26 @@ public:
         return HANDLED;
     }
 
+    // unfiltered route to one stream endpoint, the data stays in the kernel
+    auto splice_in() -> int {
+        while(true) {
+            auto client = _client.lock();
+            Spliceable* sink = client ? client->splice_sink() : nullptr;
+            if (!sink) return NOT_HANDLED;
+            int n = _splicer.pass(_fd, sink);
+            if (!_exists) return STOP;
+            if (n>0) {
+                cnt->add(StatCounters::READ,n);
+                continue;
+            }
+            if (n==-1) {
+                errno_c ret;
+                if (ret == std::error_condition(std::errc::resource_unavailable_try_again)) return HANDLED;
+            }
+            return NOT_HANDLED; // read() reports the end or the error
+        }
+    }
+
     auto epollOUT() -> int override {
         auto client = cli();
         return HANDLED;
@@ -353,6 +390,7 @@ public:
 
     int _fd = -1;
     std::weak_ptr<UARTClient> _client;
+    Splicer _splicer;
     std::shared_ptr<UdevEvents> _udev_pollable;
     bool _exists = true;
 
@@ -13,6 +13,11 @@ using namespace std::chrono_literals;
 #include "../loop.h"
 #include "../log.h"
 #include "statobj.h"
+#include "bpf.h"
+#include "coalesce.h"
+#include "fec.h"
+#include "gso.h"
+#include "peers.h"
 #include "yaml.h"
 
 
@@ -29,22 +34,28 @@ public:
     }
 
     const std::string& _name;
+    std::unique_ptr<FecDecoder> _fec;
 
     friend class UdpClientImpl;
 };
 
 class UdpClientImpl : public UdpClient, public IOPollable, public ServiceEvents {
 public:
-    UdpClientImpl(const std::string name, IOLoopSvc* loop):IOPollable(name),_loop(loop),_resolv(loop->address()),_timer(loop->timer()) {
+    UdpClientImpl(const std::string name, IOLoopSvc* loop):IOPollable(name),_loop(loop),_resolv(loop->address()),_timer(loop->timer()),_reconnect(loop->timer()) {
         _cnt = std::make_shared<StatCounters>("udpcli");
-        _cnt->tags.push_front({"endpoint",name});
+        _cnt->add_tag({"endpoint",name});
         auto on_err = [this,name](error_c& ec){ on_error(ec,name);};
         _resolv->on_error(on_err);
         _timer->on_error(on_err);
+        _reconnect->on_error(on_err);
+        _reconnect->shoot([this](){ reconnect(); });
     }
 
     ~UdpClientImpl() override {
         _exists = false;
+        _coalescer.reset();
+        _fec_encoder.reset();
+        _gso_sender.reset();
         if (_fd != -1) {
             _loop->poll()->del(_fd, this);
             for (auto& stream : _streams) {
@@ -60,7 +71,7 @@ public:
 #ifdef YAML_CONFIG
     auto init_yaml(YAML::Node cfg) -> error_c override {
         _cnt = std::make_shared<StatCounters>("udpcli");
-        _cnt->tags.push_front({"endpoint",name});
+        _cnt->add_tag({"endpoint",name});
         auto statcfg = cfg["stat"];
         if (statcfg && statcfg.IsMap()) {
             auto period = duration(statcfg["period"]);
@@ -70,10 +81,17 @@ public:
             auto tags = statcfg["tags"];
             if (tags && tags.IsMap()) {
                 for(auto tag : tags) {
-                    _cnt->tags.push_front(std::make_pair(tag.first.as<std::string>(),tag.second.as<std::string>()));
+                    _cnt->add_tag(std::make_pair(tag.first.as<std::string>(),tag.second.as<std::string>()));
                 }
             }
         }
+        _coalesce.init_yaml(cfg["coalesce"]);
+        error_c ec = _fec.init_yaml(cfg["fec"]);
+        if (ec) return ec;
+        _gso.init_yaml(cfg["gso"]);
+        ec = _bpf.init_yaml(cfg["accept"]);
+        if (ec) return ec;
+        if (cfg["connect"]) _connect = cfg["connect"].as<bool>();
         std::string itf;
         if (cfg["interface"]) itf = cfg["interface"].as<std::string>();
         if (cfg["service"]) {
@@ -145,6 +163,7 @@ public:
 
     void svc_resolved(std::string name, std::string endpoint, int itf, const SockAddr& addr) override {
         log.debug()<<"svc_resolved"<<Log::endl;
+        _peers.clear(); // peer may get a service name instead of address
         if (_fd!=-1) return;
         if (name==_service_name || endpoint==_service_name) {
             if (_itf.second && _itf.second!=itf) return;
@@ -152,6 +171,7 @@ public:
         }
     }
     void svc_removed(std::string name) override {
+        _peers.clear();
     }
 
     auto init_service(const std::string& service_name, const std::string& interface="") -> error_c override {
@@ -233,11 +253,40 @@ public:
     }
     
     auto create(const SockAddr& local, bool broadcast = false, ip_mreqn* itf = nullptr, uint8_t ttl = 0) -> error_c {
+        _coalescer.reset();
+        _fec_encoder.reset();
+        _gso_sender.reset();
+        if (_fec.k) {
+            auto timer = _loop->timer();
+            timer->on_error([this](error_c& ec){ on_error(ec,"fec");});
+            _fec_encoder = std::make_unique<FecEncoder>(_fec, std::move(timer), [this](const void* buf, int len) {
+                return send_datagram(buf,len);
+            }, _cnt);
+        }
+        if (_coalesce.mtu) {
+            auto timer = _loop->timer();
+            timer->on_error([this](error_c& ec){ on_error(ec,"coalesce");});
+            _coalescer = std::make_unique<Coalescer>(_coalesce, std::move(timer), [this](const void* buf, int len) {
+                return send_packet(buf,len);
+            });
+        }
         FD watcher(_fd);
         int family = local.family();
         _fd = socket(family, SOCK_DGRAM | SOCK_NONBLOCK, 0);
         if (_fd == -1) { return errno_c("udp client socket");
         }
+        error_c ec = _bpf.attach(_fd, family);
+        if (ec) return ec;
+        if (_gso.segments>1) {
+            auto timer = _loop->timer();
+            timer->on_error([this](error_c& ec){ on_error(ec,"gso");});
+            _gso_sender = std::make_unique<GsoSender>(_gso, std::move(timer), [this](const void* buf, int len, uint16_t segment) {
+                return send_segments(buf,len,segment);
+            });
+            _gso_sender->enable(gso_supported(_fd));
+        }
+        // the filter sees a coalesced datagram as one, so it disables GRO
+        _gro = _gso.gro && _bpf.empty() && gro_enable(_fd);
         if (broadcast) {
             int yes = 1;
             errno_c ret = to_errno_c(setsockopt(_fd, SOL_SOCKET, SO_BROADCAST, (void *) &yes, sizeof(yes)),"setsockopt(broadcast)");
@@ -264,10 +313,16 @@ public:
                 }
             }
         }
+        _connected = false;
         if (_loop->zeroconf()) {
             SockAddr local = SockAddr::any(_addr.family());
             error_c ec = local.bind(_fd);
             if (ec) return ec;
+            if (_connect && !broadcast && !itf) {
+                ec = _addr.connect(_fd);
+                if (ec) return ec;
+                _connected = true;
+            }
             SockAddr myaddr(_fd);
             if (!_group) {
                 _group = _loop->zeroconf()->get_register_group();
@@ -311,9 +366,18 @@ public:
                 on_error(ec,"poll add failure");
             });
             _group->create();
+            if (!_service_pollable) {
+                _service_pollable = std::make_shared<ServicePollableProxy>(this);
+                _loop->zeroconf()->watch_services(_service_pollable, SOCK_DGRAM);
+            }
             watcher.clear();
             return error_c();
         }
+        if (_connect && !broadcast && !itf) {
+            error_c ec = _addr.connect(_fd);
+            if (ec) return ec;
+            _connected = true;
+        }
         auto ret = _loop->poll()->add(_fd, EPOLLIN | EPOLLOUT | EPOLLET, this);
         if (ret) return ret;
         watcher.clear();
@@ -331,8 +395,12 @@ public:
                     break;
                 }
                 void* buffer = alloca(sz);
-                SockAddr addr;
-                ssize_t n = recvfrom(_fd, buffer, sz, 0, addr.sock_addr(), &addr.size());
+                PeerKey key;
+                int segment = 0;
+                ssize_t n;
+                if (_gro) { n = gro_recv(_fd, buffer, sz, key.sock_addr(), &key.len, segment);
+                } else {    n = recvfrom(_fd, buffer, sz, 0, key.sock_addr(), &key.len);
+                }
                 if (n<0) {
                     errno_c ret;
                     if (ret != std::error_condition(std::errc::resource_unavailable_try_again)) {
@@ -342,45 +410,125 @@ public:
                     if (n != sz) {
                         log.warning()<<"Datagram declared size "<<sz<<" is differ than read "<<n<<Log::endl;
                     }
-                    std::string name;
-                    if (_loop->zeroconf()) {
-                        name = _loop->zeroconf()->query_service_name(addr, SOCK_DGRAM).second;
-                    }
-                    if (name.empty()) {
-                        name = addr.format(SockAddr::REG_SERVICE);
-                    }
-                    auto& stream = _streams[name];
-                    if (stream.expired()) {
-                        auto cli = std::make_shared<UDPClientStream>(name);
-                        stream = cli;
-                        on_connect(cli,name);
+                    if (!key.normalize()) continue;
+                    auto* peer = _peers.find(key);
+                    std::shared_ptr<UDPClientStream> cli;
+                    if (peer) cli = peer->lock();
+                    if (!cli) {
+                        cli = stream(key);
                         if (!_exists) return STOP;
                     }
-                    dynamic_cast<UDPClientStream*>(stream.lock().get())->on_read(buffer, n);
-                    _cnt->add("read",n);
-                    if (!_exists) return STOP;
+                    auto cnt = _cnt;
+                    bool alive = for_each_segment(buffer, n, segment, [this, &cli](void* data, int size){
+                        if (cli->_fec) {
+                            cli->_fec->read(data, size, [str = cli.get()](void* buf, int len){ str->on_read(buf,len); });
+                        } else {
+                            cli->on_read(data, size);
+                        }
+                        return _exists;
+                    });
+                    if (!alive) return STOP;
+                    cnt->add(StatCounters::READ,n);
                 }
             }
         }
         return HANDLED;
     }
+    // slow path, first datagram from the peer or the cache is cleared
+    auto stream(PeerKey key) -> std::shared_ptr<UDPClientStream> {
+        SockAddr addr(key.sock_addr(), key.len);
+        std::string name;
+        if (_loop->zeroconf()) {
+            name = _loop->zeroconf()->query_service_name(addr, SOCK_DGRAM).second;
+        }
+        if (name.empty()) {
+            name = addr.format(SockAddr::REG_SERVICE);
+        }
+        auto it = _streams.emplace(name, std::weak_ptr<UDPClientStream>()).first;
+        auto cli = it->second.lock();
+        if (!cli) {
+            cli = std::make_shared<UDPClientStream>(it->first);
+            if (_fec.k) cli->_fec = std::make_unique<FecDecoder>(_cnt);
+            it->second = cli;
+            on_connect(cli,name);
+            if (!_exists) return cli;
+        }
+        _peers.insert(key, cli);
+        return cli;
+    }
     auto epollOUT() -> int override {
         writeable();
         if (!_exists) return STOP;
         return HANDLED;
     }
+    auto epollERR() -> int override {
+        if (_connected) {
+            int ec = udp_socket_error(_fd);
+            if (ec) peer_error(ec);
+        }
+        return HANDLED;
+    }
+
+    // ICMP errors of connected socket, returns false if the error is not caused by the peer route
+    auto peer_error(int ec) -> bool {
+        if (ec==ECONNREFUSED) { // nobody listens yet, keep sending
+            _cnt->add("refused",1);
+            return true;
+        }
+        if (!udp_route_error(ec)) return false;
+        log.info()<<"Route to "<<_addr<<" changed, reconnect"<<Log::endl;
+        reconnect();
+        return true;
+    }
+    // dissolves the association to forget the old route and source address
+    void reconnect() {
+        _cnt->add("reconnect",1);
+        sockaddr unspec{};
+        unspec.sa_family = AF_UNSPEC;
+        ::connect(_fd, &unspec, sizeof(unspec));
+        error_c ec = _addr.connect(_fd);
+        if (ec) {
+            _is_writeable = false;
+            ec = _reconnect->arm_oneshoot(1s);
+            on_error(ec,"reconnect");
+            return;
+        }
+        writeable();
+    }
 
     auto write(const void* buf, int len) -> int override {
         if (!_is_writeable) {
             return -1;
         }
-        int ret = sendto(_fd, buf, len, 0, _addr.sock_addr(), _addr.len());
+        if (_coalescer) return _coalescer->write(buf,len);
+        return send_packet(buf,len);
+    }
+
+    auto send_packet(const void* buf, int len) -> int {
+        if (_fec_encoder) return _fec_encoder->write(buf,len);
+        return send_datagram(buf,len);
+    }
+
+    auto send_datagram(const void* buf, int len) -> int {
+        if (_gso_sender) return _gso_sender->write(buf,len);
+        return send_segments(buf,len,0);
+    }
+
+    // sends one datagram or several ones of segment size
+    auto send_segments(const void* buf, int len, uint16_t segment) -> int {
+        if (_fd==-1) return -1;
+        int ret;
+        if (_connected) { ret = udp_send(_fd, nullptr, 0, buf, len, segment);
+        } else {          ret = udp_send(_fd, _addr.sock_addr(), _addr.len(), buf, len, segment);
+        }
         if (ret==-1) {
             errno_c err;
+            if (segment && gso_error(err.value())) return ret; // sender splits the buffer
+            if (_connected && peer_error(err.value())) return len;
             on_error(err, "UDP send datagram");
             _is_writeable=false;
         } else {
-            _cnt->add("write",ret);
+            _cnt->add(StatCounters::WRITE,ret);
             if (ret != len) {
                 log.error()<<"Partial send "<<ret<<" from "<<len<<" bytes"<<Log::endl;
             }
@@ -398,9 +546,21 @@ private:
     IOLoopSvc* _loop;
     std::unique_ptr<AddressResolver> _resolv;
     std::unique_ptr<Timer> _timer;
+    std::unique_ptr<Timer> _reconnect;
+    bool _connect = false;   // unicast socket is connected to the peer
+    bool _connected = false;
     std::unique_ptr<AvahiGroup> _group;
     std::map<std::string, std::weak_ptr<UDPClientStream>> _streams;
+    PeerTable<std::weak_ptr<UDPClientStream>> _peers;
     std::shared_ptr<StatCounters> _cnt;
+    FecParams _fec;
+    std::unique_ptr<FecEncoder> _fec_encoder;
+    CoalesceParams _coalesce;
+    GsoParams _gso;
+    BpfFilter _bpf; // datagrams passed to the socket
+    std::unique_ptr<GsoSender> _gso_sender; // fec encoder sends through it
+    bool _gro = false;
+    std::unique_ptr<Coalescer> _coalescer;
     inline static Log::Log log {"udpclient"};
 };
 
@@ -8,6 +8,7 @@
 #include <map>
 #include <cstring>
 #include <chrono>
+#include <functional>
 using namespace std::chrono_literals;
 #include <sys/socket.h>
 
@@ -16,18 +17,73 @@ using namespace std::chrono_literals;
 #include "../loop.h"
 #include "../log.h"
 #include "statobj.h"
+#include "bpf.h"
+#include "coalesce.h"
+#include "fec.h"
+#include "group.h"
+#include "gso.h"
+#include "peers.h"
 #include "yaml.h"
 
 std::default_random_engine reng(std::random_device{}());
 
-class UDPServerStream: public Client {
+class UDPServerStream: public Client, public IOPollable {
 public:
-    UDPServerStream(const std::string& name, int fd, SockAddr addr, std::shared_ptr<StatCounters> cnt):
-    _name(name),_fd(fd), _addr(std::move(addr)),_cnt(std::move(cnt)) {
-        _cnt->tags.push_front({"endpoint",name});
+    UDPServerStream(std::string name, int fd, const PeerKey& addr, std::shared_ptr<StatCounters> cnt):
+    IOPollable(std::move(name)),_fd(fd), _addr(addr),_cnt(std::move(cnt)) {
         writeable();
     }
+    ~UDPServerStream() override {
+        _exists = false;
+        cleanup();
+    }
+
+    // Datagram of other source: the address, data, length and gro segment,
+    // false if the stream is closed by it
+    using Foreign = std::function<bool(PeerKey&, void*, int, int)>;
+
+    // moves the peer to own socket bound to the server address and connected
+    // to the peer, the kernel delivers datagrams of the peer there. Datagrams
+    // of other peers queued before connect() are passed to the server.
+    auto connect(SockAddr local, Poll* poll, const uint32_t* tick, bool gro, const BpfFilter& bpf, Foreign foreign) -> error_c {
+        int fd = socket(local.family(), SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        if (fd == -1) return errno_c("udp peer socket");
+        FD watcher(fd);
+        error_c ret = bpf.attach(fd, local.family());
+        if (ret) return ret;
+        int yes = 1;
+        ret = to_errno_c(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)),"peer reuse port");
+        if (ret) return ret;
+        ret = local.bind(fd);
+        if (ret) return ret;
+        ret = to_errno_c(::connect(fd, _addr.sock_addr(), _addr.len),"peer connect");
+        if (ret) return ret;
+        _gro = gro && gro_enable(fd);
+        ret = poll->add(fd, EPOLLIN | EPOLLET, this);
+        if (ret) return ret;
+        watcher.clear();
+        _own = fd;
+        _poll = poll;
+        _tick = tick;
+        _foreign = std::move(foreign);
+        return error_c();
+    }
     
+    void coalesce(const CoalesceParams& params, std::unique_ptr<Timer> timer) {
+        timer->on_error([this](error_c& ec){ on_error(ec,"coalesce");});
+        _coalescer = std::make_unique<Coalescer>(params, std::move(timer), [this](const void* buf, int len) {
+            return send_packet(buf,len);
+        });
+    }
+
+    void fec(const FecParams& params, std::unique_ptr<Timer> timer) {
+        timer->on_error([this](error_c& ec){ on_error(ec,"fec");});
+        _fec_encoder = std::make_unique<FecEncoder>(params, std::move(timer), [this](const void* buf, int len) {
+            return send_datagram(buf,len);
+        }, _cnt);
+        _fec_decoder = std::make_unique<FecDecoder>(_cnt);
+    }
+
     auto write(const void* buf, int len) -> int override { 
         if (!_is_writeable) {
             return -1;
@@ -35,13 +91,49 @@ public:
         if (_fd==-1) {
             return -1;
         }
-        int ret = sendto(_fd, buf, len, 0, _addr.sock_addr(), _addr.len());
+        if (_group) {
+            _cnt->add(StatCounters::WRITE,len);
+            return _group->write(_group_gen, _addr, buf, len);
+        }
+        if (_coalescer) return _coalescer->write(buf,len);
+        return send_packet(buf,len);
+    }
+
+    auto send_packet(const void* buf, int len) -> int {
+        if (_fec_encoder) return _fec_encoder->write(buf,len);
+        return send_datagram(buf,len);
+    }
+
+    void gso(const GsoParams& params, std::unique_ptr<Timer> timer, bool enable) {
+        timer->on_error([this](error_c& ec){ on_error(ec,"gso");});
+        _gso_sender = std::make_unique<GsoSender>(params, std::move(timer), [this](const void* buf, int len, uint16_t segment) {
+            return send_segments(buf,len,segment);
+        });
+        _gso_sender->enable(enable);
+    }
+
+    auto send_datagram(const void* buf, int len) -> int {
+        if (_gso_sender) return _gso_sender->write(buf,len);
+        return send_segments(buf,len,0);
+    }
+
+    // sends one datagram or several ones of segment size
+    auto send_segments(const void* buf, int len, uint16_t segment) -> int {
+        if (_fd==-1) {
+            return -1;
+        }
+        int ret;
+        if (_own!=-1) { ret = udp_send(_own, nullptr, 0, buf, len, segment);
+        } else {        ret = udp_send(_fd, _addr.sock_addr(), _addr.len, buf, len, segment);
+        }
         if (ret==-1) {
             errno_c err;
+            if (segment && gso_error(err.value())) return ret; // sender splits the buffer
+            if (_own!=-1 && peer_error(err.value())) return len;
             on_error(err, "UDP send datagram");
             _is_writeable=false;
         } else {
-            _cnt->add("write",ret);
+            _cnt->add(StatCounters::WRITE,ret);
             /*if (ret != len) {
             log.error()<<"Partial send "<<ret<<" from "<<len<<" bytes"<<Log::endl;
         }*/
@@ -50,34 +142,138 @@ public:
     }
 
     void on_read(void* buf, int len) override {
-        Readable::on_read(buf,len);
-        _cnt->add("read",len);
+        _cnt->add(StatCounters::READ,len);
+        if (_fec_decoder) {
+            _fec_decoder->read(buf, len, [this](void* data, int size){ Readable::on_read(data,size); });
+        } else {
+            Readable::on_read(buf,len);
+        }
+    }
+
+    auto epollIN() -> int override {
+        while(_own!=-1) {
+            int sz;
+            errno_c ret = to_errno_c(ioctl(_own, FIONREAD, &sz),"udp ioctl");
+            if (ret) {
+                on_error(ret, "Query datagram size error");
+                if (!_exists) return STOP;
+                break;
+            }
+            void* buffer = alloca(sz ? sz : 1);
+            PeerKey key;
+            int segment = 0;
+            ssize_t n;
+            if (_gro) { n = gro_recv(_own, buffer, sz, key.sock_addr(), &key.len, segment);
+            } else {    n = recvfrom(_own, buffer, sz, 0, key.sock_addr(), &key.len);
+            }
+            if (n<0) {
+                errno_c ret;
+                if (ret == std::error_condition(std::errc::resource_unavailable_try_again)) break;
+                if (!peer_error(ret.value())) on_error(ret, "udp recv");
+                if (!_exists) return STOP;
+                continue;
+            }
+            if (sz==0) break;
+            if (key.normalize() && !(key==_addr)) {
+                if (!_foreign(key, buffer, n, segment)) return STOP;
+                if (!_exists) return STOP;
+                continue;
+            }
+            _seen = *_tick;
+            bool alive = for_each_segment(buffer, n, segment, [this](void* data, int size){
+                on_read(data, size);
+                return _exists;
+            });
+            if (!alive) return STOP;
+        }
+        return HANDLED;
+    }
+    auto epollERR() -> int override {
+        if (_own!=-1) {
+            int ec = udp_socket_error(_own);
+            if (ec) peer_error(ec);
+        }
+        return HANDLED;
+    }
+
+    // ICMP errors of connected socket, returns false if the error is not caused by the peer route
+    auto peer_error(int ec) -> bool {
+        if (ec==ECONNREFUSED) { // peer port is closed, idle timeout releases the stream
+            _cnt->add("refused",1);
+            return true;
+        }
+        if (!udp_route_error(ec)) return false;
+        _cnt->add("reconnect",1);
+        // connect again selects new route, without disconnection since the
+        // socket would get datagrams of other peers meanwhile
+        if (::connect(_own, _addr.sock_addr(), _addr.len)==-1) {
+            errno_c ret("peer reconnect");
+            log.warning()<<"Peer "<<name<<" uses server socket: "<<ret<<Log::endl;
+            cleanup();
+        }
+        return true;
     }
 
     auto get_peer_name() -> const std::string& override {
-        return _name;
+        return name;
+    }
+
+    void cleanup() override {
+        if (_own!=-1) {
+            _poll->del(_own, this);
+            close(_own);
+            _own = -1;
+        }
     }
 
     void on_close() override { 
-        Closeable::on_close();
+        if (_coalescer) _coalescer->flush();
+        if (_fec_encoder) _fec_encoder->flush();
+        if (_gso_sender) _gso_sender->flush();
+        cleanup();
         _fd = -1;
+        _group = nullptr;
         _is_writeable = false;
+        Closeable::on_close(); // the stream may be released here
     }
 
-    const std::string& _name;
-    int _fd = -1;
-    SockAddr _addr;
-    std::shared_ptr<StatCounters> _cnt;
+    int _fd = -1;  // server socket
+    int _own = -1; // connected socket of the peer
+    uint32_t _seen = 0; // sweep tick of the last received datagram
+    uint32_t _group_gen = 0; // the last frame got from group sender
+    bool _exists = true;
+    bool _gro = false;
+    PeerKey _addr;
+    Foreign _foreign; // server path for datagrams of other peers
+    Poll* _poll = nullptr;
+    const uint32_t* _tick = nullptr;
+    GroupSender* _group = nullptr; // owned by the server
+    std::shared_ptr<StatCounters> _cnt; // shared by all peers of the server
+    std::unique_ptr<GsoSender> _gso_sender; // fec encoder flushes to it, so it destroyed last
+    std::unique_ptr<FecEncoder> _fec_encoder;
+    std::unique_ptr<FecDecoder> _fec_decoder;
+    std::unique_ptr<Coalescer> _coalescer; // flushes to fec encoder, so it destroyed first
+    inline static Log::Log log {"udpserver"};
 
     friend class UdpServerImpl;
 };
 
 class UdpServerImpl : public UdpServer, public IOPollable, public ServiceEvents {
 public:
-    UdpServerImpl(const std::string name, IOLoopSvc* loop):IOPollable(name),_loop(loop),_ports(20000,50000) {
+    UdpServerImpl(const std::string name, IOLoopSvc* loop):IOPollable(name),_loop(loop),_ports(20000,50000),_sweep(loop->timer()) {
+        _cnt = std::make_shared<StatCounters>("udpsvr");
+        _cnt->add_tag({"endpoint",name});
+        _cnt_peers = _cnt->handle("peers");
+        _cnt_new = _cnt->handle("peer_new");
+        _cnt_expired = _cnt->handle("peer_expired");
+        _cnt_evicted = _cnt->handle("peer_evicted");
+        _cnt_rejected = _cnt->handle("peer_rejected");
+        _sweep->on_error([this](error_c& ec){ on_error(ec,"peers sweep"); });
+        _sweep->shoot([this](){ sweep(); });
     }
     ~UdpServerImpl() override {
         _exists = false;
+        _sweep->stop();
         if (_fd != -1) {
             _loop->poll()->del(_fd, this);
             for (auto& stream : _streams) {
@@ -85,6 +281,7 @@ public:
                 if (cli) { cli->on_close();
                 }
             }
+            if (_sender) _sender->flush();
             on_error(to_errno_c(close(_fd),"close"));
             _fd = -1;
         }
@@ -123,6 +320,25 @@ public:
         return *this;
     }
 
+    auto peers(std::chrono::nanoseconds idle, int max, bool evict) -> UdpServer& override {
+        _idle = idle;
+        _max_peers = max;
+        _evict = evict;
+        return *this;
+    }
+
+    // SO_REUSEPORT of peer sockets would let other process of the user share
+    // the server port silently, so the port has to be free before it is set.
+    // Peer sockets left from the previous init are ours.
+    auto port_free(SockAddr& addr) -> error_c {
+        if (!addr.port() || !_streams.empty()) return error_c();
+        int fd = socket(addr.family(), SOCK_DGRAM, 0);
+        if (fd == -1) return errno_c("udp port probe");
+        FD watcher(fd);
+        if (::bind(fd, addr.sock_addr(), addr.len())==-1 && errno==EADDRINUSE) return errno_c("udp port "+std::to_string(addr.port()));
+        return error_c(); // other errors are reported by the bind of the server
+    }
+
     auto setup_fd(uint16_t port, Mode mode, SockAddr &addr) -> error_c {
         if (_fd!=-1) {
             ::close(_fd);
@@ -133,6 +349,8 @@ public:
         _fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
         if (_fd == -1) { return errno_c("udp server socket");
         }
+        error_c ec = _bpf.attach(_fd, AF_INET); // before bind, no datagram gets in unfiltered
+        if (ec) return ec;
         
         if (mode == UNICAST) {
             if (!_address.empty()) {
@@ -157,11 +375,19 @@ public:
                 log.error()<<"Can't detect address to hear"<<Log::endl;
                 return errno_c(EADDRNOTAVAIL);
             }
+            if (_connect) { // peer sockets share the port
+                error_c ret = port_free(addr);
+                if (ret) return ret;
+                int yes = 1;
+                ret = to_errno_c(setsockopt(_fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)),"reuse port");
+                if (ret) return ret;
+            }
             error_c ret = addr.bind(_fd);
             if (!ret && addr.port()==0) {
                 addr.init(_fd);
             }
             if (ret) return ret;
+            if (_connect) _local = addr;
         } else if (mode == BROADCAST) {
             if (!_address.empty()) {
                 if (addr.init(_address,port)) {
@@ -268,10 +494,21 @@ public:
             auto tags = statcfg["tags"];
             if (tags && tags.IsMap()) {
                 for(auto tag : tags) {
-                    stat_tags.push_front(std::make_pair(tag.first.as<std::string>(),tag.second.as<std::string>()));
+                    _cnt->add_tag(std::make_pair(tag.first.as<std::string>(),tag.second.as<std::string>()));
                 }
             }
         }
+        auto peercfg = cfg["peers"];
+        if (peercfg && peercfg.IsMap()) {
+            if (peercfg["idle"]) _idle = duration(peercfg["idle"]);
+            if (peercfg["max"]) _max_peers = peercfg["max"].as<int>();
+            if (peercfg["policy"]) {
+                auto policy = peercfg["policy"].as<std::string>();
+                if (policy=="evict") {       _evict = true;
+                } else if (policy=="reject") { _evict = false;
+                } else return errno_c(EINVAL,"peers policy");
+            }
+        }
         int family = address_family(cfg["family"]);
         if (family==AF_UNSPEC) family = AF_INET;
         std::string data;
@@ -281,6 +518,22 @@ public:
         if (cfg["address"]) data = cfg["address"].as<std::string>();
         if (!data.empty()) address(data);
         if (cfg["ttl"]) _ttl = cfg["ttl"].as<int>();
+        if (cfg["connect"]) _connect = cfg["connect"].as<bool>();
+        _coalesce.init_yaml(cfg["coalesce"]);
+        _gso.init_yaml(cfg["gso"]);
+        auto groupcfg = cfg["group"];
+        if (groupcfg && groupcfg.IsScalar()) {
+            _group_mode = groupcfg.as<bool>();
+        } else if (groupcfg && groupcfg.IsMap()) {
+            _group_mode = true;
+            if (!groupcfg["address"] || !groupcfg["port"]) return errno_c(EINVAL,"group address and port");
+            _group_address = groupcfg["address"].as<std::string>();
+            _group_port = groupcfg["port"].as<int>();
+        }
+        error_c ec = _fec.init_yaml(cfg["fec"]);
+        if (ec) return ec;
+        ec = _bpf.init_yaml(cfg["accept"]);
+        if (ec) return ec;
         auto cfgports = cfg["ports"];
         if (cfgports) {
             if (cfgports["min"] && cfgports["max"]) {
@@ -296,8 +549,24 @@ public:
     auto init(uint16_t port=0, Mode mode = UNICAST) -> error_c override {
         if (!_loop->zeroconf() && port==0) return errno_c(EINVAL,"Zero port");
         SockAddr addr;
+        _local = SockAddr();
         error_c ret = setup_fd(port,mode, addr);
         if (ret) return ret;
+        _gso_ok = _gso.segments>1 && gso_supported(_fd);
+        // the filter sees a coalesced datagram as one, so it disables GRO
+        _gro = _gso.gro && _bpf.empty() && gro_enable(_fd);
+        if (_group_mode) {
+            ret = setup_group(mode, addr);
+            if (ret) return ret;
+        }
+        if (!_registered) {
+            _loop->stats()->register_report(_cnt, stat_period);
+            _registered = true;
+        }
+        if (!_sweep->armed()) { // ticks are needed for eviction even without idle timeout
+            ret = _sweep->arm_periodic(_idle.count() ? _idle/sweep_ticks : 1s);
+            if (ret) return ret;
+        }
         if (!_loop->zeroconf()) {
             ret = _loop->poll()->add(_fd, EPOLLIN | EPOLLOUT | EPOLLET, this);
             if (ret) return ret;
@@ -342,8 +611,12 @@ public:
                     break;
                 }
                 void* buffer = alloca(sz);
-                SockAddr addr;
-                ssize_t n = recvfrom(_fd, buffer, sz, 0, addr.sock_addr(), &addr.size());
+                PeerKey key;
+                int segment = 0;
+                ssize_t n;
+                if (_gro) { n = gro_recv(_fd, buffer, sz, key.sock_addr(), &key.len, segment);
+                } else {    n = recvfrom(_fd, buffer, sz, 0, key.sock_addr(), &key.len);
+                }
                 if (n<0) {
                     errno_c ret;
                     if (ret != std::error_condition(std::errc::resource_unavailable_try_again)) {
@@ -353,29 +626,163 @@ public:
                     if (n != sz) {
                         log.warning()<<"Datagram declared size "<<sz<<" is differ than read "<<n<<Log::endl;
                     }
-                    std::string name;
-                    if (_loop->zeroconf()) {
-                        name = _loop->zeroconf()->query_service_name(addr, SOCK_DGRAM).first;
-                    }
-                    if (name.empty()) {
-                        name = addr.format(SockAddr::REG_SERVICE);
-                    }
-                    auto& stream = _streams[name];
-                    if (stream.expired()) {
-                        auto stat = std::make_shared<StatCounters>("tcpcli");
-                        _loop->stats()->register_report(stat, 1s);
-                        auto cli = std::make_shared<UDPServerStream>(name,_fd, std::move(addr),stat);
-                        stream = cli;
-                        on_connect(cli,name);
-                        if (!_exists) return STOP;
-                    }
-                    dynamic_cast<UDPServerStream*>(stream.lock().get())->on_read(buffer, n);
-                    if (!_exists) return STOP;
+                    if (!key.normalize()) continue;
+                    if (!datagram(key, buffer, n, segment)) return STOP;
                 }
             }
         }
         return HANDLED;
     }
+    // delivers the datagram to the peer stream, false if the server is released
+    auto datagram(PeerKey& key, void* buffer, int n, int segment) -> bool {
+        auto* peer = _peers.find(key);
+        std::shared_ptr<UDPServerStream> cli;
+        if (peer) cli = peer->lock();
+        if (!cli) {
+            if (peer && !_evict && _max_peers && int(_streams.size())>=_max_peers) {
+                _cnt->add(_cnt_rejected,1); // known rejected peer, retried after the next sweep
+                return true;
+            }
+            cli = stream(key);
+            if (!_exists) return false;
+            if (!cli) return true;
+        }
+        cli->_seen = _tick;
+        return for_each_segment(buffer, n, segment, [this, &cli](void* data, int size){
+            cli->on_read(data, size);
+            return _exists;
+        });
+    }
+    // a frame which goes to all peers of multicast and broadcast server is
+    // sent to the server address, otherwise by batches of sendmmsg()
+    auto setup_group(Mode mode, const SockAddr& addr) -> error_c {
+        if (!_sender) {
+            _sender = std::make_unique<GroupSender>(_fd, _loop, _cnt, [this]() {
+                size_t n = 0;
+                for (auto& stream : _streams) if (!stream.second.expired()) n++;
+                return n;
+            });
+            _sender->on_error([this](error_c& ec){ on_error(ec); });
+        }
+        _sender->fd(_fd);
+        if (_fec.k || _coalesce.mtu || _gso.segments) {
+            log.warning()<<"Group send ignores fec, coalesce and gso of peers"<<Log::endl;
+        }
+        SockAddr target;
+        if (!_group_address.empty()) {
+            error_c ret = target.init(_group_address, _group_port);
+            if (ret) return ret;
+        } else if (mode!=UNICAST) {
+            target = addr;
+        }
+        if (!target.len()) return error_c();
+        return _sender->target(std::move(target));
+    }
+    // slow path, first datagram from the peer or the cache is cleared
+    auto stream(PeerKey key) -> std::shared_ptr<UDPServerStream> {
+        SockAddr addr(key.sock_addr(), key.len);
+        std::string name;
+        if (_loop->zeroconf()) {
+            name = _loop->zeroconf()->query_service_name(addr, SOCK_DGRAM).first;
+        }
+        if (name.empty()) {
+            name = addr.format(SockAddr::REG_SERVICE);
+        }
+        auto it = _streams.find(name);
+        std::shared_ptr<UDPServerStream> cli;
+        if (it!=_streams.end()) {
+            cli = it->second.lock();
+            if (!cli) {
+                _streams.erase(it);
+                _cnt->add(_cnt_peers,-1);
+            }
+        }
+        if (!cli) {
+            if (_max_peers && int(_streams.size())>=_max_peers && !make_room()) {
+                _cnt->add(_cnt_rejected,1);
+                _peers.insert(key, cli);
+                return cli;
+            }
+            cli = std::make_shared<UDPServerStream>(name,_fd,key,_cnt);
+            cli->_group = _sender.get();
+            if (_local.len()) {
+                error_c ec = cli->connect(_local, _loop->poll(), &_tick, _gso.gro && _bpf.empty(), _bpf, [this](PeerKey& key, void* buf, int n, int segment) {
+                    return datagram(key, buf, n, segment);
+                });
+                if (ec) log.warning()<<"Peer "<<name<<" uses server socket: "<<ec<<Log::endl;
+            }
+            if (_fec.k) cli->fec(_fec, _loop->timer());
+            if (_coalesce.mtu) cli->coalesce(_coalesce, _loop->timer());
+            if (_gso.segments>1) cli->gso(_gso, _loop->timer(), _gso_ok);
+            cli->_seen = _tick;
+            _streams[name] = cli;
+            _cnt->add(_cnt_new,1);
+            _cnt->add(_cnt_peers,1);
+            on_connect(cli,name);
+            if (!_exists) return cli;
+        }
+        _peers.insert(key, cli);
+        return cli;
+    }
+    // frees place for a new peer, closes the longest silent one
+    auto make_room() -> bool {
+        prune();
+        if (int(_streams.size())<_max_peers) return true;
+        if (!_evict || _streams.empty()) return false;
+        auto oldest = _streams.end();
+        std::shared_ptr<UDPServerStream> victim;
+        for(auto it = _streams.begin(); it!=_streams.end(); ++it) {
+            auto cli = it->second.lock();
+            if (cli && (!victim || _tick-cli->_seen > _tick-victim->_seen)) {
+                victim = cli;
+                oldest = it;
+            }
+        }
+        if (!victim) return true;
+        log.info()<<"Evict peer "<<oldest->first<<Log::endl;
+        _streams.erase(oldest);
+        close_peer(*victim);
+        _cnt->add(_cnt_evicted,1);
+        _peers.erase_if([](auto& peer){ return peer.expired(); });
+        return true;
+    }
+    void close_peer(UDPServerStream& cli) {
+        _cnt->add(_cnt_peers,-1);
+        cli.on_close();
+    }
+    // drops streams released by the application
+    void prune() {
+        for(auto it = _streams.begin(); it!=_streams.end();) {
+            if (it->second.expired()) {
+                _cnt->add(_cnt_peers,-1);
+                it = _streams.erase(it);
+            } else ++it;
+        }
+    }
+    // closes peers silent for more than idle time, the timer period is idle/sweep_ticks
+    void sweep() {
+        _tick++;
+        bool closed = false;
+        for(auto it = _streams.begin(); it!=_streams.end();) {
+            auto cli = it->second.lock();
+            if (cli && (!_idle.count() || _tick-cli->_seen<=sweep_ticks)) {
+                ++it;
+                continue;
+            }
+            if (cli) {
+                log.debug()<<"Peer "<<it->first<<" is idle"<<Log::endl;
+                _cnt->add(_cnt_expired,1);
+                it = _streams.erase(it);
+                close_peer(*cli);
+                if (!_exists) return;
+            } else {
+                _cnt->add(_cnt_peers,-1);
+                it = _streams.erase(it);
+            }
+            closed = true;
+        }
+        if (closed || _peers.size()>_streams.size()) _peers.erase_if([](auto& peer){ return peer.expired(); });
+    }
     auto epollOUT() -> int override {
         for (auto& stream : _streams) {
             auto cli = stream.second.lock();
@@ -388,15 +795,17 @@ public:
     }
 
     void svc_resolved(std::string name, std::string endpoint, int itf, const SockAddr& addr) override {
+        _peers.clear(); // peer may get a service name instead of address
     }
     void svc_removed(std::string name) override {
+        _peers.clear();
         // we have to close client stream when the service gone
         auto stream_it = _streams.find(name);
         if (stream_it!=_streams.end()) {
             auto cli = stream_it->second.lock();
             if (cli) { 
-                cli->on_close(); 
-                _streams.erase(name);
+                _streams.erase(stream_it);
+                close_peer(*cli);
             }
         }
     }
@@ -406,13 +815,35 @@ private:
     std::pair<std::string,int> _itf = {"",0};
     uint8_t _ttl = 0;
     int _family = AF_INET; //TODO: add family setup function
+    bool _connect = false; // connected socket per peer, unicast only
+    SockAddr _local; // server address for peer sockets
     std::uniform_int_distribution<uint16_t> _ports;
     int _fd = -1;
     bool _exists = true;
     IOLoopSvc* _loop;
     std::chrono::nanoseconds stat_period = 1s;
-    std::forward_list<std::pair<std::string,std::string>> stat_tags;
+    std::shared_ptr<StatCounters> _cnt;
+    StatCounters::Handle _cnt_peers, _cnt_new, _cnt_expired, _cnt_evicted, _cnt_rejected;
+    bool _registered = false;
     std::map<std::string, std::weak_ptr<UDPServerStream>> _streams;
+    PeerTable<std::weak_ptr<UDPServerStream>> _peers;
+    // only received datagrams are activity, so peers are kept unless configured
+    std::chrono::nanoseconds _idle = 0s;
+    int _max_peers = 0;
+    bool _evict = true;
+    std::unique_ptr<Timer> _sweep;
+    uint32_t _tick = 0;
+    static constexpr uint32_t sweep_ticks = 4;
+    CoalesceParams _coalesce;
+    FecParams _fec;
+    GsoParams _gso;
+    BpfFilter _bpf; // datagrams passed to the socket
+    bool _gso_ok = false; // kernel supports UDP_SEGMENT
+    bool _group_mode = false;
+    std::string _group_address;
+    uint16_t _group_port = 0;
+    std::unique_ptr<GroupSender> _sender;
+    bool _gro = false;
     std::unique_ptr<AvahiGroup> _group;
     std::shared_ptr<ServiceEvents> _service_pollable;
     inline static Log::Log log {"udpserver"};
@@ -0,0 +1,470 @@
+#ifndef __UNIX__H__
+#define __UNIX__H__
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <forward_list>
+#include <fstream>
+#include <vector>
+using namespace std::chrono_literals;
+
+#include "../err.h"
+#include "../loop.h"
+#include "../log.h"
+#include "fd.h"
+#include "splice.h"
+#include "statobj.h"
+#include "yaml.h"
+
+// Address of AF_UNIX socket, path starting with '@' is in the abstract namespace
+struct UnixAddr {
+    sockaddr_un addr{};
+    socklen_t len = 0;
+    std::string path;
+
+    auto init(const std::string& p) -> error_c {
+        if (p.empty() || p.size()>=sizeof(addr.sun_path)) return errno_c(EINVAL,"unix socket path "+p);
+        path = p;
+        addr = sockaddr_un{};
+        addr.sun_family = AF_UNIX;
+        std::memcpy(addr.sun_path, p.data(), p.size());
+        if (abstract()) { // no terminating zero, the length tells the name
+            addr.sun_path[0] = '\0';
+            len = offsetof(sockaddr_un, sun_path) + p.size();
+        } else {
+            len = offsetof(sockaddr_un, sun_path) + p.size() + 1;
+        }
+        return error_c();
+    }
+    auto abstract() const -> bool { return path[0]=='@';
+    }
+    auto sock_addr() const -> const sockaddr* { return reinterpret_cast<const sockaddr*>(&addr);
+    }
+};
+
+// Process name and id of the peer from its credentials
+inline auto unix_peer(int fd, std::string& comm) -> pid_t {
+    ucred cred{};
+    socklen_t len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len)==-1) return 0;
+    std::ifstream file("/proc/"+std::to_string(cred.pid)+"/comm");
+    std::getline(file, comm);
+    if (comm.empty()) comm = "pid"+std::to_string(cred.pid);
+    return cred.pid;
+}
+
+// Connection of AF_UNIX socket. Seqpacket connection keeps boundaries of
+// the packets, a zero length packet can't be told from the end of stream.
+class UnixStream : public Client, public Spliceable, public IOPollable {
+public:
+    UnixStream(const std::string& name, int fd, int type, IOLoopSvc* loop, std::shared_ptr<StatCounters> cnt):
+        IOPollable(name),_fd(fd),_type(type),_poll(loop->poll()),_cnt(std::move(cnt)) {
+        _cnt->add_tag({"endpoint",name});
+        if (_type==SOCK_SEQPACKET) _buffer.resize(max_packet);
+    }
+    ~UnixStream() override {
+        _exists = false;
+        if (_fd!=-1) _poll->del(_fd, this);
+        cleanup();
+    }
+    auto start() -> error_c {
+        error_c ret = _poll->add(_fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, this);
+        if (ret) return ret;
+        writeable();
+        return error_c();
+    }
+    // called before on_close() by the endpoint which created the stream
+    void closed(OnEventFunc func) { _closed = func;
+    }
+    auto get_peer_name() -> const std::string& override {
+        return name;
+    }
+    auto epollIN() -> int override {
+        if (_type==SOCK_STREAM && _splicer.enabled()) {
+            int ret = splice_in();
+            if (ret!=NOT_HANDLED) return ret;
+        }
+        while(true) {
+            if (_type==SOCK_STREAM) {
+                int sz;
+                errno_c ret = to_errno_c(ioctl(_fd, FIONREAD, &sz),"unix ioctl");
+                if (ret) {
+                    on_error(ret, "Query data size error");
+                    if (!_exists) return STOP;
+                    return HANDLED;
+                }
+                if (_buffer.size()<size_t(sz)) _buffer.resize(sz);
+            }
+            if (_buffer.empty()) _buffer.resize(1); // to see the end of stream
+            ssize_t n = recv(_fd, _buffer.data(), _buffer.size(), _type==SOCK_SEQPACKET ? MSG_TRUNC : 0);
+            if (n==-1) {
+                errno_c ret;
+                if (ret != std::error_condition(std::errc::resource_unavailable_try_again)) {
+                    on_error(ret, "unix recv");
+                    if (!_exists) return STOP;
+                }
+                return HANDLED;
+            }
+            if (n==0) {
+                close_stream();
+                return STOP;
+            }
+            if (n>ssize_t(_buffer.size())) {
+                log.warning()<<"Packet of "<<n<<" bytes is truncated to "<<_buffer.size()<<Log::endl;
+                n = _buffer.size();
+            }
+            _cnt->add(StatCounters::READ,n);
+            on_read(_buffer.data(), n);
+            if (!_exists) return STOP;
+        }
+    }
+    // unfiltered route to one stream endpoint, the data stays in the kernel
+    auto splice_in() -> int {
+        while(Spliceable* sink = splice_sink()) {
+            int n = _splicer.pass(_fd, sink);
+            if (!_exists) return STOP;
+            if (n>0) {
+                _cnt->add(StatCounters::READ,n);
+                continue;
+            }
+            if (n==-1) {
+                errno_c ret;
+                if (ret == std::error_condition(std::errc::resource_unavailable_try_again)) return HANDLED;
+            }
+            break; // recv() reports the end or the error
+        }
+        return NOT_HANDLED;
+    }
+    auto epollOUT() -> int override {
+        writeable();
+        if (!_exists) return STOP;
+        return HANDLED;
+    }
+    auto epollERR() -> int override {
+        int ec = 0;
+        socklen_t len = sizeof(ec);
+        if (getsockopt(_fd, SOL_SOCKET, SO_ERROR, &ec, &len)==0 && ec) {
+            errno_c ret(ec,"unix socket error");
+            on_error(ret);
+        }
+        return HANDLED;
+    }
+    auto epollRDHUP() -> int override {
+        close_stream();
+        return STOP;
+    }
+    auto epollHUP() -> int override { return epollRDHUP();
+    }
+    void cleanup() override {
+        if (_fd != -1) {
+            close(_fd);
+            _fd = -1;
+        }
+    }
+    auto write(const void* buf, int len) -> int override {
+        if (!_is_writeable) return 0;
+        ssize_t n = send(_fd, buf, len, MSG_NOSIGNAL);
+        _is_writeable = n==len;
+        if (n==-1) {
+            errno_c ret;
+            if (ret != std::error_condition(std::errc::resource_unavailable_try_again)) {
+                on_error(ret, "unix send");
+                if (ret==std::error_condition(std::errc::broken_pipe)) {
+                    close_stream(); // the stream may be released here
+                    return n;
+                }
+            }
+        } else {
+            _cnt->add(StatCounters::WRITE,n);
+        }
+        return n;
+    }
+    // splice() would merge packets of seqpacket connection
+    auto splice_fd() -> int override { return _type==SOCK_STREAM ? _fd : -1;
+    }
+    void spliced(int n) override {
+        if (n==-1) {
+            errno_c ret;
+            if (ret != std::error_condition(std::errc::resource_unavailable_try_again)) {
+                on_error(ret, "unix splice");
+                if (ret==std::error_condition(std::errc::broken_pipe)) close_stream();
+            }
+        } else {
+            _cnt->add(StatCounters::WRITE,n);
+        }
+    }
+    void close_stream() {
+        if (_fd==-1) return;
+        error_c ret = _poll->del(_fd, this);
+        on_error(ret,"unix socket cleanup");
+        cleanup();
+        _is_writeable = false;
+        if (_closed) _closed();
+        on_close(); // the stream may be released here
+    }
+private:
+    static constexpr size_t max_packet = 65536;
+    int _fd = -1;
+    int _type;
+    Poll* _poll;
+    bool _exists = true;
+    std::shared_ptr<StatCounters> _cnt;
+    std::vector<char> _buffer;
+    Splicer _splicer;
+    OnEventFunc _closed;
+    inline static Log::Log log {"unixstream"};
+};
+
+// Listens AF_UNIX socket, the clients are named by the process name from
+// their credentials, the process id is added if the name is taken.
+class UnixServerImpl : public UnixServer, public IOPollable {
+public:
+    UnixServerImpl(const std::string name, IOLoopSvc* loop):IOPollable(name),_loop(loop),_timer(loop->timer()) {
+        _timer->on_error([this,name](error_c& ec){ on_error(ec,name);});
+        _timer->shoot([this](){ create(); });
+    }
+    ~UnixServerImpl() override {
+        _exists = false;
+        if (_fd!=-1) _loop->poll()->del(_fd, this);
+        cleanup();
+    }
+
+#ifdef YAML_CONFIG
+    auto init_yaml(YAML::Node cfg) -> error_c override {
+        auto statcfg = cfg["stat"];
+        if (statcfg && statcfg.IsMap()) {
+            auto period = duration(statcfg["period"]);
+            if (period.count()) {
+                stat_period = period;
+            }
+            auto tags = statcfg["tags"];
+            if (tags && tags.IsMap()) {
+                for(auto tag : tags) {
+                    stat_tags.push_front(make_pair(tag.first.as<std::string>(),tag.second.as<std::string>()));
+                }
+            }
+        }
+        if (cfg["mode"]) _mode = std::stoi(cfg["mode"].as<std::string>(), nullptr, 8);
+        if (!cfg["path"]) return errno_c(ENOTSUP,"unix server path");
+        return init(cfg["path"].as<std::string>(), unix_socket_type(cfg["type"]));
+    }
+#endif
+
+    auto init(const std::string& path, int type) -> error_c override {
+        error_c ec = _addr.init(path);
+        if (ec) return ec;
+        if (type!=SOCK_STREAM && type!=SOCK_SEQPACKET) return errno_c(EINVAL,"unix socket type");
+        _type = type;
+        create();
+        return error_c();
+    }
+
+    void create() {
+        error_c ec = create_socket();
+        if (on_error(ec,"create unix server")) {
+            if (!_exists) return;
+            _timer->arm_oneshoot(3s);
+        }
+    }
+
+    // the socket file is left by previous run if nobody listens there,
+    // otherwise another server has it
+    auto remove_stale() -> error_c {
+        int fd = socket(AF_UNIX, _type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd == -1) return errno_c("unix probe socket");
+        FD watcher(fd);
+        if (::connect(fd, _addr.sock_addr(), _addr.len)==-1) {
+            if (errno==ENOENT) return error_c();
+            if (errno==ECONNREFUSED) {
+                unlink(_addr.path.c_str());
+                return error_c();
+            }
+        }
+        return errno_c(EADDRINUSE,"unix server "+_addr.path);
+    }
+
+    auto create_socket() -> error_c {
+        if (_fd!=-1) {
+            _loop->poll()->del(_fd, this);
+            cleanup();
+        }
+        _fd = socket(AF_UNIX, _type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (_fd == -1) { return errno_c("unix server socket");
+        }
+        FD watcher(_fd);
+        struct stat sb{};
+        if (!_addr.abstract() && lstat(_addr.path.c_str(), &sb)==0 && S_ISSOCK(sb.st_mode)) {
+            error_c ret = remove_stale();
+            if (ret) return ret;
+        }
+        error_c ret = to_errno_c(bind(_fd, _addr.sock_addr(), _addr.len),"unix bind "+_addr.path);
+        if (ret) return ret;
+        _bound = true;
+        if (_mode && !_addr.abstract()) {
+            ret = to_errno_c(chmod(_addr.path.c_str(), _mode),"unix socket mode");
+            if (ret) return ret;
+        }
+        ret = to_errno_c(listen(_fd, 16),"listen");
+        if (ret) return ret;
+        ret = _loop->poll()->add(_fd, EPOLLIN, this);
+        if (ret) return ret;
+        watcher.clear();
+        log.info()<<"Listen "<<_addr.path<<Log::endl;
+        return error_c();
+    }
+
+    auto epollIN() -> int override {
+        while(true) {
+            int client = accept4(_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (client==-1) {
+                errno_c ret("accept");
+                if (ret!=std::error_condition(std::errc::resource_unavailable_try_again) &&
+                    ret!=std::error_condition(std::errc::operation_would_block)) {
+                        on_error(ret);
+                        if (!_exists) return STOP;
+                }
+                return HANDLED;
+            }
+            std::string name;
+            pid_t pid = unix_peer(client, name);
+            if (name.empty()) name = _addr.path;
+            _streams.erase(std::remove_if(_streams.begin(),_streams.end(),[](auto& s){ return s.expired(); }),_streams.end());
+            bool taken = std::any_of(_streams.begin(),_streams.end(),[&name](auto& s){
+                auto str = s.lock();
+                return str && str->get_peer_name()==name;
+            });
+            if (taken) name += ':'+std::to_string(pid);
+            auto cnt = std::make_shared<StatCounters>("unixsvr");
+            cnt->set_tags(stat_tags);
+            if (stat_period.count()) _loop->stats()->register_report(cnt, stat_period);
+            auto cli = std::make_shared<UnixStream>(name, client, _type, _loop, std::move(cnt));
+            error_c ec = cli->start();
+            if (ec) {
+                on_error(ec,"unix stream");
+                if (!_exists) return STOP;
+                continue;
+            }
+            _streams.push_back(cli);
+            cli->on_error([this](error_c ec){on_error(ec);});
+            on_connect(cli, name);
+            if (!_exists) return STOP;
+        }
+    }
+
+    void cleanup() override {
+        if (_fd != -1) {
+            close(_fd);
+            _fd = -1;
+        }
+        if (_bound && !_addr.abstract()) unlink(_addr.path.c_str());
+        _bound = false;
+    }
+
+private:
+    UnixAddr _addr;
+    int _type = SOCK_STREAM;
+    mode_t _mode = 0;
+    int _fd = -1;
+    bool _bound = false;
+    bool _exists = true;
+    IOLoopSvc* _loop;
+    std::vector<std::weak_ptr<UnixStream>> _streams;
+    std::chrono::nanoseconds stat_period = 1s;
+    std::forward_list<std::pair<std::string,std::string>> stat_tags;
+    std::unique_ptr<Timer> _timer;
+    inline static Log::Log log {"unixserver"};
+};
+
+// Connects AF_UNIX socket, the connection is named by the socket path.
+// It is connected again after the server closes it.
+class UnixClientImpl : public UnixClient {
+public:
+    UnixClientImpl(const std::string name, IOLoopSvc* loop):_name(name),_loop(loop),_timer(loop->timer()) {
+        _timer->on_error([this,name](error_c& ec){ on_error(ec,name);});
+        _timer->shoot([this](){ connect(); });
+    }
+    ~UnixClientImpl() override {
+        if (_stream) _stream->closed(nullptr);
+    }
+
+#ifdef YAML_CONFIG
+    auto init_yaml(YAML::Node cfg) -> error_c override {
+        auto statcfg = cfg["stat"];
+        if (statcfg && statcfg.IsMap()) {
+            auto period = duration(statcfg["period"]);
+            if (period.count()) {
+                stat_period = period;
+            }
+            auto tags = statcfg["tags"];
+            if (tags && tags.IsMap()) {
+                for(auto tag : tags) {
+                    stat_tags.push_front(make_pair(tag.first.as<std::string>(),tag.second.as<std::string>()));
+                }
+            }
+        }
+        if (!cfg["path"]) return errno_c(ENOTSUP,"unix client path");
+        return init(cfg["path"].as<std::string>(), unix_socket_type(cfg["type"]));
+    }
+#endif
+
+    auto init(const std::string& path, int type) -> error_c override {
+        error_c ec = _addr.init(path);
+        if (ec) return ec;
+        if (type!=SOCK_STREAM && type!=SOCK_SEQPACKET) return errno_c(EINVAL,"unix socket type");
+        _type = type;
+        connect();
+        return error_c();
+    }
+
+    void connect() {
+        _stream.reset(); // closed one, released by the router already
+        error_c ec = create_connection();
+        if (on_error(ec,"connect "+_addr.path)) _timer->arm_oneshoot(3s);
+    }
+
+    auto create_connection() -> error_c {
+        int fd = socket(AF_UNIX, _type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd == -1) { return errno_c("unix client socket");
+        }
+        FD watcher(fd);
+        error_c ret = to_errno_c(::connect(fd, _addr.sock_addr(), _addr.len),"unix connect");
+        if (ret) return ret;
+        auto cnt = std::make_shared<StatCounters>("unixcli");
+        cnt->set_tags(stat_tags);
+        if (stat_period.count()) _loop->stats()->register_report(cnt, stat_period);
+        auto stream = std::make_shared<UnixStream>(_addr.path, fd, _type, _loop, std::move(cnt));
+        watcher.clear();
+        ret = stream->start();
+        if (ret) return ret;
+        stream->on_error([this](error_c ec){on_error(ec,_name);});
+        stream->closed([this](){
+            log.info()<<"Connection "<<_addr.path<<" closed"<<Log::endl;
+            _timer->arm_oneshoot(1s);
+        });
+        _stream = stream;
+        log.info()<<"Connected "<<_addr.path<<Log::endl;
+        on_connect(stream, _addr.path);
+        return error_c();
+    }
+
+private:
+    std::string _name;
+    UnixAddr _addr;
+    int _type = SOCK_STREAM;
+    IOLoopSvc* _loop;
+    std::shared_ptr<UnixStream> _stream;
+    std::chrono::nanoseconds stat_period = 1s;
+    std::forward_list<std::pair<std::string,std::string>> stat_tags;
+    std::unique_ptr<Timer> _timer;
+    inline static Log::Log log {"unixclient"};
+};
+
+#endif  //!__UNIX__H__
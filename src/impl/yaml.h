@@ -5,25 +5,10 @@
 #include <string>
 #include <sys/socket.h>
 
+#include "../inc/config.h"
 #include "../inc/endpoints.h"
 
-auto duration(YAML::Node cfg) -> std::chrono::nanoseconds {
-    if (!cfg) return std::chrono::nanoseconds(0);
-    std::string period = cfg.as<std::string>();
-    std::size_t pos;
-    int count = std::stoi(period,&pos);
-    auto suffix = period.substr(pos);
-    if (suffix.empty()) return std::chrono::seconds(count);
-    if (suffix=="s") return std::chrono::seconds(count);
-    if (suffix=="ms") return std::chrono::milliseconds(count);
-    if (suffix=="us") return std::chrono::microseconds(count);
-    if (suffix=="ns") return std::chrono::nanoseconds(count);
-    if (suffix=="m") return std::chrono::minutes(count);
-    if (suffix=="h") return std::chrono::hours(count);
-    return std::chrono::nanoseconds(0);
-}
-
-auto address_family(YAML::Node cfg) -> int {
+inline auto address_family(YAML::Node cfg) -> int {
     if (!cfg) return AF_UNSPEC;
     std::string data = cfg.as<std::string>();
     if (data=="v4") return AF_INET;
@@ -31,7 +16,7 @@ auto address_family(YAML::Node cfg) -> int {
     return AF_UNSPEC;
 }
 
-auto udp_type(YAML::Node cfg) -> UdpServer::Mode {
+inline auto udp_type(YAML::Node cfg) -> UdpServer::Mode {
     if (!cfg) return UdpServer::Mode::UNICAST;
     std::string data = cfg.as<std::string>();
     if (data=="unicast") return UdpServer::Mode::UNICAST;
@@ -40,5 +25,13 @@ auto udp_type(YAML::Node cfg) -> UdpServer::Mode {
     return UdpServer::Mode::UNICAST;
 }
 
+inline auto unix_socket_type(YAML::Node cfg) -> int {
+    if (!cfg) return SOCK_STREAM;
+    std::string data = cfg.as<std::string>();
+    if (data=="stream") return SOCK_STREAM;
+    if (data=="seqpacket") return SOCK_SEQPACKET;
+    return 0;
+}
+
 #endif //YAML_CONFIG
 #endif  //!__YAML__H__
\ No newline at end of file
@@ -0,0 +1,27 @@
+#ifndef __CONFIG_INC_H__
+#define __CONFIG_INC_H__
+#ifdef YAML_CONFIG
+#include <chrono>
+#include <string>
+#include <yaml-cpp/yaml.h>
+
+// Time value of config: number with ns, us, ms, s, m or h suffix, seconds
+// without suffix, 0 if the node is absent or the suffix is unknown
+inline auto duration(YAML::Node cfg) -> std::chrono::nanoseconds {
+    if (!cfg) return std::chrono::nanoseconds(0);
+    std::string period = cfg.as<std::string>();
+    std::size_t pos;
+    int count = std::stoi(period,&pos);
+    auto suffix = period.substr(pos);
+    if (suffix.empty()) return std::chrono::seconds(count);
+    if (suffix=="s") return std::chrono::seconds(count);
+    if (suffix=="ms") return std::chrono::milliseconds(count);
+    if (suffix=="us") return std::chrono::microseconds(count);
+    if (suffix=="ns") return std::chrono::nanoseconds(count);
+    if (suffix=="m") return std::chrono::minutes(count);
+    if (suffix=="h") return std::chrono::hours(count);
+    return std::chrono::nanoseconds(0);
+}
+
+#endif //YAML_CONFIG
+#endif  //!__CONFIG_INC_H__
@@ -1,7 +1,10 @@
 #ifndef __ENDPOINTS_H__
 #define __ENDPOINTS_H__
+#include <chrono>
 #include <functional>
 #include <memory>
+#include <string>
+#include <vector>
 #include <sys/socket.h>
 
 #include "../err.h"
@@ -9,26 +12,41 @@
 #include <yaml-cpp/yaml.h>
 #endif //YAML_CONFIG
 /*
-               UART  TCP_SRV TCPSRV_STREAM TCP_CLI UDP_SRV UDP_SRV_STREAM UDP_CLI
-on_read          X      0          X          X       0          X           X
-on_write         X      0          X          X       X          0           X
+               UART  TCP_SRV TCPSRV_STREAM TCP_CLI UDP_SRV UDP_SRV_STREAM UDP_CLI TUNNEL TUNNEL_STREAM
+on_read          X      0          X          X       0          X           X      0         X
+on_write         X      0          X          X       X          0           X      0         X
 on_connect
-(on_name)        X      0          0          X       0          0           X
-on_connect_cli   0      X          0          0       X          0           0
-on_close         X      X          X          X       X          X           X
+(on_name)        X      0          0          X       0          0           X      0         0
+on_connect_cli   0      X          0          0       X          0           0      X         0
+on_close         X      X          X          X       X          X           X      X         X
 */
 using OnEventFunc = std::function<void()>;
 
+// Byte stream endpoint data can be moved to by splice() bypassing user space
+class Spliceable {
+public:
+    virtual ~Spliceable() = default;
+    virtual auto splice_fd() -> int = 0; // -1 if not connected
+    // result of splice() to splice_fd(), handled as the result of write()
+    virtual void spliced(int n) = 0;
+};
+
 class Readable : public error_handler {
 public:
     virtual ~Readable() = default;
     using OnReadFunc  = std::function<void(void*, int)>;
+    using OnSpliceFunc  = std::function<Spliceable*()>;
     void on_read(OnReadFunc func) {_on_read = func;}
+    // returns the endpoint all data goes to unchanged, stream endpoints
+    // move data there by splice() instead of on_read()
+    void on_splice(OnSpliceFunc func) {_on_splice = func;}
     virtual auto get_peer_name() -> const std::string& = 0;
 protected:
     virtual void on_read(void* buf, int len) { if (_on_read) _on_read(buf, len); }
+    auto splice_sink() -> Spliceable* { return _on_splice ? _on_splice() : nullptr; }
 private:
     OnReadFunc _on_read;
+    OnSpliceFunc _on_splice;
 };
 
 class Writeable {
@@ -116,10 +134,46 @@ public:
     virtual auto interface(const std::string& interface, int family = AF_INET) -> UdpServer& = 0;
     virtual auto service_port_range(uint16_t min, uint16_t max) -> UdpServer& = 0;
     virtual auto ttl(uint8_t ttl_) -> UdpServer& = 0;
+    // peers which sent nothing for idle are closed (0 - never, default), when
+    // max peers exist (0 - unlimited, default) a new one replaces the longest
+    // silent peer if evict is set or is ignored
+    virtual auto peers(std::chrono::nanoseconds idle, int max, bool evict = true) -> UdpServer& = 0;
 
     virtual auto init(uint16_t port=0, Mode mode = UNICAST) -> error_c = 0;
 };
 
+// Pseudo-terminal for programs which talk to serial ports only
+class Pty: public StreamSource {
+public:
+    // link is the symlink to the slave device, output is paced to the baudrate, 0 - no pacing
+    virtual auto init(const std::string& link, int baudrate=0) -> error_c = 0;
+};
+
+// Local connections over AF_UNIX sockets of SOCK_STREAM or SOCK_SEQPACKET type,
+// path starting with '@' is in the abstract namespace
+class UnixServer:  public StreamSource {
+public:
+    virtual auto init(const std::string& path, int type = SOCK_STREAM) -> error_c = 0;
+};
+
+class UnixClient:  public StreamSource {
+public:
+    virtual auto init(const std::string& path, int type = SOCK_STREAM) -> error_c = 0;
+};
+
+// Packet rings in shared memory for local processes, the client side is in shmring.h
+class ShmRing:  public StreamSource {
+public:
+    // size of each direction ring, rounded up to power of 2
+    virtual auto init(const std::string& segment, size_t size = 1<<20) -> error_c = 0;
+};
+
+// Multiplexes named streams over one connection to the other router
+class Tunnel:  public StreamSource {
+public:
+    virtual auto init(std::shared_ptr<StreamSource> transport, const std::vector<std::string>& streams, bool sequence=false) -> error_c = 0;
+};
+
 #include "stat.h"
 class Endpoint : public error_handler, public Writeable, public Configurable {
 public:
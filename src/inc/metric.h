@@ -1,69 +1,116 @@
 #ifndef __METRIC__H__
 #define __METRIC__H__
+#include <charconv>
+#include <chrono>
+#include <cstdio>
 #include <string>
 #include <string_view>
-#include <chrono>
-#include <variant>
-#include <sstream>
-#include <memory>
-
-template<class... Ts> struct overloaded : Ts... { using Ts::operator()...; };
-template<class... Ts> overloaded(Ts...) -> overloaded<Ts...>;
+#include <type_traits>
 
+// Influx line protocol record.
+// Measurement name with tags and fields are kept serialized, numbers are
+// formatted with to_chars. Object can be reset and reused, its buffers
+// keep their capacity so steady reports don't allocate.
+// Time is optional, unset time is taken from the reporting tick.
 class Metric {
 public:
-    Metric(std::string name):_name(std::move(name)),_time(std::chrono::system_clock::now()) {}
+    using Time = std::chrono::time_point<std::chrono::system_clock>;
+    Metric() = default;
+    Metric(std::string_view name):_head(name) {}
     ~Metric() = default;
 
-    void add_field(std::string_view name, std::variant<int, long long int, std::string, double, std::chrono::nanoseconds> value) {
-        if (_fields.tellp()!=0) _fields << ",";
-        _fields << name << "=";
-        std::visit([this](auto&& v) {
-            using T = std::decay_t<decltype(v)>;
-            if constexpr (std::is_same_v<T, int>)
-                _fields << v << 'i';
-            else if constexpr (std::is_same_v<T, long long int>)
-                _fields << v << 'i';
-            else if constexpr (std::is_same_v<T, double>)
-                _fields << v;
-            else if constexpr (std::is_same_v<T, std::string>)
-                _fields << '"' << v << '"';
-            else if constexpr (std::is_same_v<T, std::chrono::nanoseconds>)
-                _fields << v.count() << 'i';
-        }, value);
+    // head is measurement name with serialized tags: name,key=value
+    void reset(std::string_view head) {
+        _head.assign(head);
+        _fields.clear();
+        _time = Time();
+    }
+    auto empty() const -> bool { return _fields.empty();
+    }
+
+    template<class T, std::enable_if_t<std::is_integral_v<T>, int> = 0>
+    void add_field(std::string_view name, T value) {
+        field_name(name);
+        append(_fields, value);
+        _fields += 'i';
+    }
+    void add_field(std::string_view name, double value) {
+        field_name(name);
+        append(_fields, value);
+    }
+    void add_field(std::string_view name, std::chrono::nanoseconds value) {
+        add_field(name, static_cast<long long int>(value.count()));
     }
-    auto field(std::string_view name, std::variant<int, long long int, std::string, double, std::chrono::nanoseconds> value) -> Metric&& {
+    void add_field(std::string_view name, std::string_view value) {
+        field_name(name);
+        _fields += '"';
+        _fields += value;
+        _fields += '"';
+    }
+    void add_field(std::string_view name, const char* value) {
+        add_field(name, std::string_view(value));
+    }
+    template<class T>
+    auto field(std::string_view name, T value) -> Metric&& {
         add_field(name, value);
         return std::move(*this);
     }
     auto add_tag(std::string_view key, std::string_view value) -> Metric& {
-        _tags <<"," << key << "=" << value;
+        _head += ',';
+        _head += key;
+        _head += '=';
+        _head += value;
         return *this;
     }
     auto tag(std::string_view key, std::string_view value) -> Metric&& {
         add_tag(key, value);
         return std::move(*this);
     }
-    auto time(std::chrono::time_point<std::chrono::system_clock> stamp) -> Metric&& {
+    auto time(Time stamp) -> Metric&& {
         _time = stamp;
         return std::move(*this);
     }
 
-    void to_stream(std::ostream& out, std::string_view global_tags="") {
+    // appends one line without line feed, metric without fields is skipped
+    void serialize(std::string& out, std::string_view global_tags, Time stamp) const {
         using namespace std::chrono;
-        if (_fields.tellp()==0) return;
-        out<<_name<<_tags.str();
-        if (global_tags.size()!=0) { out<<global_tags;
-        }
-        out<<' '<<_fields.str()<<' ';
-        out<<std::to_string(duration_cast<nanoseconds>(_time.time_since_epoch()).count());
+        if (_fields.empty()) return;
+        if (_time!=Time()) stamp = _time;
+        out += _head;
+        out += global_tags;
+        out += ' ';
+        out += _fields;
+        out += ' ';
+        append(out, static_cast<long long int>(duration_cast<nanoseconds>(stamp.time_since_epoch()).count()));
+    }
+
+    template<class T, std::enable_if_t<std::is_integral_v<T>, int> = 0>
+    static void append(std::string& out, T value) {
+        char buf[24];
+        auto res = std::to_chars(buf, buf+sizeof(buf), value);
+        out.append(buf, res.ptr-buf);
+    }
+    static void append(std::string& out, double value) {
+        char buf[32];
+#if __cpp_lib_to_chars >= 201611L
+        auto res = std::to_chars(buf, buf+sizeof(buf), value);
+        out.append(buf, res.ptr-buf);
+#else
+        int len = std::snprintf(buf, sizeof(buf), "%.17g", value);
+        out.append(buf, len);
+#endif
     }
 
 private:
-    std::string _name;
-    std::chrono::time_point<std::chrono::system_clock> _time;
-    std::stringstream _tags;
-    std::stringstream _fields;
+    void field_name(std::string_view name) {
+        if (!_fields.empty()) _fields += ',';
+        _fields += name;
+        _fields += '=';
+    }
+
+    std::string _head;
+    std::string _fields;
+    Time _time;
 };
 
-#endif  //!__METRIC__H__
\ No newline at end of file
+#endif  //!__METRIC__H__
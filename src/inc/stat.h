@@ -3,25 +3,118 @@
 #include "../err.h"
 #include "metric.h"
 #include "endpoints.h"
+#include <atomic>
+#include <cstdint>
 #include <memory>
 #include <forward_list>
+#include <vector>
 
 // Class to send measurements
 class OStat {
 public:
-    virtual void send(Metric&& metric) = 0;
+    virtual void send(const Metric& metric) = 0;
     virtual void flush() = 0;
     virtual ~OStat() = default;
 };
 
 
+// Receives current values of stats on scrape, see Stat::expose
+class OExpose {
+public:
+    // labels are rendered as key="value",...
+    virtual void counter(std::string_view name, std::string_view field, std::string_view labels, double value) = 0;
+    // the same with one more label of the sample, as msgid="30"
+    virtual void counter(std::string_view name, std::string_view field, std::string_view labels, std::string_view label, double value) = 0;
+    // counts[i] is the number of values up to edges[i], the last one of the
+    // values above all edges, sum is of all values
+    virtual void histogram(std::string_view name, std::string_view field, std::string_view labels,
+                           const std::vector<int64_t>& edges, const std::vector<int64_t>& counts, double sum) = 0;
+    virtual ~OExpose() = default;
+};
+
+// Storage of live counter values outside of the process, see shmstat.h
+class StatShare {
+public:
+    // returns nullptr when there is no free entry
+    virtual auto slot(std::string_view key, uint32_t kind) -> std::atomic<int64_t>* = 0;
+    virtual void release(std::atomic<int64_t>* value) = 0;
+    virtual ~StatShare() = default;
+};
+
 // Base class to send collected stats
 class Stat {
 public:
     virtual void report(OStat& out) = 0;
+    // Current values for pull exposition. Values are read in place and
+    // nothing is reset, so it doesn't interfere with periodic reports.
+    virtual void expose(OExpose& out) {}
+    // Keeps values in shared entries from now on, updated on every change
+    virtual void share(std::shared_ptr<StatShare> shm) {}
     virtual ~Stat() = default;
 
-    std::forward_list<std::pair<std::string,std::string>> tags;
+    using Tags = std::forward_list<std::pair<std::string,std::string>>;
+    // tags are changed by these calls only, cached prefix and labels are
+    // rebuilt after them
+    void set_tags(Tags values) {
+        _tags = std::move(values);
+        _tags_gen++;
+    }
+    void add_tag(std::pair<std::string,std::string> tag) {
+        _tags.push_front(std::move(tag));
+        _tags_gen++;
+    }
+    auto tags() const -> const Tags& { return _tags;
+    }
+
+    // Reusable metric with name and tags serialized once.
+    auto metric(std::string_view name) -> Metric& {
+        _metric.reset(prefix(name));
+        return _metric;
+    }
+    // measurement name with tags: name,key=value
+    auto prefix(std::string_view name) -> const std::string& {
+        if (_prefix.empty() || _tags_gen!=_prefix_gen) {
+            _prefix.assign(name);
+            for(auto& tag: _tags) {
+                _prefix += ',';
+                _prefix += tag.first;
+                _prefix += '=';
+                _prefix += tag.second;
+            }
+            _prefix_gen = _tags_gen;
+        }
+        return _prefix;
+    }
+    // tags as exposition labels, cached the same way as metric prefix
+    auto labels() -> const std::string& {
+        if (_tags_gen!=_labels_gen) {
+            _labels.clear();
+            for(auto& tag: _tags) {
+                if (!_labels.empty()) _labels += ',';
+                _labels += tag.first;
+                _labels += "=\"";
+                for(char c : tag.second) {
+                    if (c=='\\' || c=='"') { _labels += '\\';
+                    } else if (c=='\n') { _labels += "\\n";
+                        continue;
+                    }
+                    _labels += c;
+                }
+                _labels += '"';
+            }
+            _labels_gen = _tags_gen;
+        }
+        return _labels;
+    }
+
+private:
+    Tags _tags;
+    uint32_t _tags_gen = 1; // caches start invalid
+    std::string _prefix;
+    uint32_t _prefix_gen = 0;
+    std::string _labels;
+    uint32_t _labels_gen = 0;
+    Metric _metric;
 };
 
 class OStatEndpoint : public OStat {
@@ -40,6 +133,10 @@ public:
 #endif //YAML_CONFIG
     virtual void clear_outputs() = 0;
     virtual void register_report(std::shared_ptr<Stat> source, std::chrono::nanoseconds period) = 0;
+    // serves registered stats in OpenMetrics text format over http
+    virtual auto expose(uint16_t port, const std::string& address="") -> error_c = 0;
+    // keeps registered counters in shared memory segment /dev/shm/<name>
+    virtual auto share(const std::string& name, int capacity=1024) -> error_c = 0;
 };
 
 #endif  //!__STAT_INC_H__
\ No newline at end of file
@@ -16,10 +16,15 @@ public:
     using OnEvent = std::function<void()>;
     // loop items
     virtual auto uart(const std::string& name) -> std::unique_ptr<UART> = 0;
+    virtual auto pty(const std::string& name) -> std::unique_ptr<Pty> = 0;
     virtual auto tcp_client(const std::string& name) -> std::unique_ptr<TcpClient> = 0;
     virtual auto udp_client(const std::string& name) -> std::unique_ptr<UdpClient> = 0;
     virtual auto tcp_server(const std::string& name) -> std::unique_ptr<TcpServer> = 0;
     virtual auto udp_server(const std::string& name) -> std::unique_ptr<UdpServer> = 0;
+    virtual auto tunnel(const std::string& name) -> std::unique_ptr<Tunnel> = 0;
+    virtual auto unix_server(const std::string& name) -> std::unique_ptr<UnixServer> = 0;
+    virtual auto unix_client(const std::string& name) -> std::unique_ptr<UnixClient> = 0;
+    virtual auto shm_ring(const std::string& name) -> std::unique_ptr<ShmRing> = 0;
     virtual auto signal_handler() -> std::unique_ptr<Signal> = 0;
     virtual auto timer() -> std::unique_ptr<Timer> = 0;
     virtual auto outfile() -> std::unique_ptr<OFileStream> = 0;
@@ -1,6 +1,17 @@
+#include <fcntl.h>
+#include <syslog.h>
+#include <time.h>
 #include <unistd.h>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 #include <utility>
 #include <avahi-core/log.h>
 #include "log.h"
@@ -10,32 +21,307 @@ namespace Log {
     public:
         auto overflow(int c) -> int final { return c; }
     };
-    NullBuffer null_buffer;
-    std::ostream null_stream(&null_buffer);
+    // badbit: operator<< doesn't format arguments
+    class NullStream : public std::ostream {
+    public:
+        NullStream():std::ostream(&_buffer) { setstate(std::ios::badbit); }
+    private:
+        NullBuffer _buffer;
+    };
+    NullStream null_stream;
     static bool use_color = false;
+    static std::atomic<int> rate{0};
 
-    auto _log(Level level, Level max_level) -> std::ostream& {
-        if (max_level<level) return null_stream;
-        if (use_color) {
-            switch (level) {
-                case Level::DISABLE: break;
-                case Level::ERROR:
-                    std::cerr<<"\033[31m"; //RED
-                    break;
-                case Level::WARNING:
-                    std::cerr<<"\033[36m"; //CYAN
-                    break;
-                case Level::NOTICE:
-                    std::cerr<<"\033[33m"; //YELLOW
-                    break;
-                case Level::INFO:
-                    std::cerr<<"\033[97m"; //WHITE
-                    break;
-                case Level::DEBUG:
-                    std::cerr<<"\033[94m"; //LIGHTBLUE
+    constexpr int QUEUE_SIZE = 512;  // records, power of 2
+    constexpr int TEXT_SIZE = 1000;  // longer records are cut
+    constexpr int NAME_SIZE = 24;
+
+    struct Record {
+        std::atomic<uint64_t> seq;
+        Level level;
+        bool cut;
+        int len;
+        timespec time;
+        char name[NAME_SIZE];
+        char text[TEXT_SIZE];
+    };
+
+    // Bounded lock-free queue of records (D.Vyukov's MPMC queue with the only
+    // consumer) and the thread which formats and writes them. A producer
+    // wakes the thread only if it sleeps, a full queue drops records.
+    class Writer {
+    public:
+        Writer() {
+            for(uint64_t i=0;i<QUEUE_SIZE;i++) _queue[i].seq.store(i, std::memory_order_relaxed);
+        }
+        ~Writer() { stop();
+        }
+        void start() {
+            if (_thread.joinable()) return;
+            _stop = false;
+            _thread = std::thread([this]() { run(); });
+            _running.store(true, std::memory_order_release);
+        }
+        void stop() {
+            if (!_thread.joinable()) return;
+            {
+                std::lock_guard<std::mutex> lock(_wake_mutex);
+                _stop = true;
+            }
+            _wake.notify_one();
+            _thread.join();
+            _running.store(false, std::memory_order_release);
+            drain(); // records queued while the thread was stopping
+        }
+        void push(Level level, const std::string& name, const char* text, int len, bool cut) {
+            if (!_running.load(std::memory_order_acquire)) {
+                Record record;
+                fill(record, level, name, text, len, cut);
+                std::lock_guard<std::mutex> lock(_sink_mutex);
+                write(record);
+                flush();
+                return;
+            }
+            uint64_t pos = _head.load(std::memory_order_relaxed);
+            Record* slot;
+            while (true) {
+                slot = &_queue[pos & (QUEUE_SIZE-1)];
+                uint64_t seq = slot->seq.load(std::memory_order_acquire);
+                int64_t dif = int64_t(seq)-int64_t(pos);
+                if (dif==0) {
+                    if (_head.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) break;
+                } else if (dif<0) {
+                    _dropped.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                } else {
+                    pos = _head.load(std::memory_order_relaxed);
+                }
+            }
+            fill(*slot, level, name, text, len, cut);
+            slot->seq.store(pos+1, std::memory_order_release);
+            // pairs with the fence of the writer going to sleep
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (_sleeping.load(std::memory_order_relaxed) && _sleeping.exchange(false)) {
+                std::lock_guard<std::mutex> lock(_wake_mutex);
+                _wake.notify_one();
             }
         }
-        return std::cerr;
+        auto output(const std::string& target) -> bool {
+            std::lock_guard<std::mutex> lock(_sink_mutex);
+            if (_fd>STDERR_FILENO) close(_fd);
+            if (_syslog) closelog();
+            _fd = STDERR_FILENO;
+            _syslog = false;
+            if (target.empty() || target=="stderr") return true;
+            if (target=="syslog") {
+                openlog(nullptr, LOG_PID, LOG_DAEMON);
+                _syslog = true;
+                return true;
+            }
+            int fd = open(target.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+            if (fd==-1) return false;
+            _fd = fd;
+            return true;
+        }
+    private:
+        static void fill(Record& record, Level level, const std::string& name, const char* text, int len, bool cut) {
+            record.level = level;
+            record.cut = cut;
+            record.len = len;
+            clock_gettime(CLOCK_REALTIME_COARSE, &record.time);
+            size_t n = std::min<size_t>(name.size(), NAME_SIZE-1);
+            memcpy(record.name, name.data(), n);
+            record.name[n] = 0;
+            memcpy(record.text, text, len);
+        }
+        void run() {
+            while (true) {
+                if (drain()) continue;
+                std::unique_lock<std::mutex> lock(_wake_mutex);
+                if (_stop) return;
+                _sleeping.store(true, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (ready()) {
+                    _sleeping.store(false, std::memory_order_relaxed);
+                    continue;
+                }
+                _wake.wait(lock, [this]() { return _stop || !_sleeping.load(std::memory_order_relaxed); });
+            }
+        }
+        auto ready() -> bool {
+            const Record& slot = _queue[_tail & (QUEUE_SIZE-1)];
+            return slot.seq.load(std::memory_order_acquire)==_tail+1;
+        }
+        // false if the queue is empty
+        auto drain() -> bool {
+            if (!ready()) return false;
+            std::lock_guard<std::mutex> lock(_sink_mutex);
+            while (ready()) {
+                Record& slot = _queue[_tail & (QUEUE_SIZE-1)];
+                write(slot);
+                slot.seq.store(_tail+QUEUE_SIZE, std::memory_order_release);
+                _tail++;
+            }
+            uint64_t dropped = _dropped.exchange(0, std::memory_order_relaxed);
+            if (dropped) {
+                Record record;
+                std::string text = std::to_string(dropped)+" log records dropped, the queue is full";
+                fill(record, Level::WARNING, "log", text.data(), text.size(), false);
+                write(record);
+            }
+            flush();
+            return true;
+        }
+        // formats the record to the output buffer or sends it to syslog
+        void write(const Record& record) {
+            if (_syslog) {
+                static const int priority[] = {LOG_DEBUG, LOG_ERR, LOG_WARNING, LOG_NOTICE, LOG_INFO, LOG_DEBUG};
+                syslog(priority[int(record.level)], "%s: %.*s%s", record.name, record.len, record.text, record.cut ? "..." : "");
+                return;
+            }
+            if (_fd!=STDERR_FILENO) {
+                static const char* names[] = {"", "ERROR", "WARNING", "NOTICE", "INFO", "DEBUG"};
+                char stamp[64];
+                struct tm tm;
+                localtime_r(&record.time.tv_sec, &tm);
+                size_t n = strftime(stamp, sizeof(stamp), "%F %T", &tm);
+                snprintf(stamp+n, sizeof(stamp)-n, ".%03ld %s %s: ", record.time.tv_nsec/1000000, names[int(record.level)], record.name);
+                _out.append(stamp);
+            } else if (use_color) {
+                switch (record.level) {
+                    case Level::DISABLE: break;
+                    case Level::ERROR:   _out.append("\033[31m"); break; //RED
+                    case Level::WARNING: _out.append("\033[36m"); break; //CYAN
+                    case Level::NOTICE:  _out.append("\033[33m"); break; //YELLOW
+                    case Level::INFO:    _out.append("\033[97m"); break; //WHITE
+                    case Level::DEBUG:   _out.append("\033[94m"); break; //LIGHTBLUE
+                }
+            }
+            _out.append(record.text, record.len);
+            if (record.cut) _out.append("...");
+            if (use_color && _fd==STDERR_FILENO) _out.append("\033[0m");
+            _out.push_back('\n');
+            if (_out.size()>=65536) flush();
+        }
+        void flush() {
+            size_t done = 0;
+            while (done<_out.size()) {
+                ssize_t n = ::write(_fd, _out.data()+done, _out.size()-done);
+                if (n<=0) {
+                    if (n==-1 && errno==EINTR) continue;
+                    break; // nowhere to report
+                }
+                done += n;
+            }
+            _out.clear();
+        }
+
+        std::array<Record,QUEUE_SIZE> _queue;
+        alignas(64) std::atomic<uint64_t> _head{0};
+        alignas(64) uint64_t _tail = 0;
+        std::atomic<uint64_t> _dropped{0};
+        std::atomic<bool> _sleeping{false};
+        std::atomic<bool> _running{false};
+        bool _stop = false;
+        std::mutex _wake_mutex;
+        std::condition_variable _wake;
+        std::thread _thread;
+        std::mutex _sink_mutex;
+        int _fd = STDERR_FILENO;
+        bool _syslog = false;
+        std::string _out;
+    };
+    // never destroyed, destructors of other statics log at exit too;
+    // the thread is stopped by the exit handler registered in init()
+    static auto writer() -> Writer& {
+        static Writer& w = *new Writer;
+        return w;
+    }
+
+    // Text of the current record of the thread, committed on flush of the
+    // stream (Log::endl, std::endl) or when the next record starts
+    class RecordBuffer : public std::streambuf {
+    public:
+        RecordBuffer() { setp(_text.data(), _text.data()+_text.size());
+        }
+        void start(Level level, const std::string& name, int suppressed) {
+            if (pbase()!=pptr()) commit();
+            _level = level;
+            _name = &name;
+            _suppressed = suppressed;
+        }
+    protected:
+        auto overflow(int c) -> int override {
+            _cut = true;
+            return c;
+        }
+        auto sync() -> int override {
+            if (pbase()!=pptr() || _cut) commit();
+            return 0;
+        }
+    private:
+        void commit() {
+            int len = pptr()-pbase();
+            while (len && _text[len-1]=='\n') len--;
+            if (_suppressed && !_cut) {
+                int n = snprintf(_text.data()+len, _text.size()-len, " (%d similar suppressed)", _suppressed);
+                len = std::min<int>(len+n, _text.size());
+            }
+            writer().push(_level, *_name, _text.data(), len, _cut);
+            setp(_text.data(), _text.data()+_text.size());
+            _cut = false;
+            _suppressed = 0;
+        }
+        std::array<char,TEXT_SIZE> _text;
+        Level _level = Level::DEBUG;
+        const std::string* _name = nullptr;
+        int _suppressed = 0;
+        bool _cut = false;
+    };
+
+    // Records of one place of code in the current second
+    struct Site {
+        int64_t second = 0;
+        int count = 0;
+        int suppressed = 0;
+    };
+    // file is a literal, its address is enough
+    struct SiteKey {
+        const char* file;
+        int line;
+        auto operator==(const SiteKey& other) const -> bool { return file==other.file && line==other.line; }
+    };
+    struct SiteHash {
+        auto operator()(const SiteKey& key) const -> size_t {
+            return std::hash<const void*>()(key.file) ^ (size_t(key.line)*0x9E3779B97F4A7C15ull);
+        }
+    };
+
+    struct ThreadRecords {
+        RecordBuffer buffer;
+        std::ostream stream{&buffer};
+        std::unordered_map<SiteKey, Site, SiteHash> sites;
+    };
+    // never released, destructors log at exit too
+    thread_local ThreadRecords* records = nullptr;
+
+    // false if the site has written its records of this second
+    static auto pass(const SiteKey& site, int limit, int& suppressed) -> bool {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+        auto& s = records->sites[site];
+        if (s.second!=now.tv_sec) {
+            s.second = now.tv_sec;
+            s.count = 0;
+        }
+        if (s.count>=limit) {
+            s.suppressed++;
+            return false;
+        }
+        s.count++;
+        suppressed = s.suppressed;
+        s.suppressed = 0;
+        return true;
     }
 
     static std::map<std::string, Log*> *loggers = nullptr;
@@ -46,9 +332,17 @@ namespace Log {
     };
     Log::~Log() { loggers->erase(_name);
     }
-        
-    void Log::set_level(Level level) {max_level = level;}   
-    auto Log::log(Level level) -> std::ostream& { return _log(Level::DEBUG, max_level); }
+
+    void Log::set_level(Level level) {max_level = level;}
+    auto Log::log(Level level, const char* file, int line) -> std::ostream& {
+        if (max_level<level) return null_stream;
+        if (!records) records = new ThreadRecords();
+        int suppressed = 0;
+        int limit = rate.load(std::memory_order_relaxed);
+        if (limit && !pass({file, line}, limit, suppressed)) return null_stream;
+        records->buffer.start(level, _name, suppressed);
+        return records->stream;
+    }
 
     void avahiLogFunction(AvahiLogLevel level, const char *txt) {
         static Log log("libavahi");
@@ -67,23 +361,35 @@ namespace Log {
     void init() {
         use_color = isatty(STDERR_FILENO);
         avahi_set_log_function(avahiLogFunction);
+        static bool registered = false;
+        if (!registered) {
+            std::atexit([]() { writer().stop(); });
+            registered = true;
+        }
+        writer().start();
+    }
+
+    auto output(const std::string& target) -> bool {
+        bool ret = writer().output(target);
+        use_color = ret && (target.empty() || target=="stderr") && isatty(STDERR_FILENO);
+        return ret;
+    }
+
+    void rate_limit(int per_second) { rate.store(per_second, std::memory_order_relaxed);
     }
 
     auto endl(std::ostream& os) -> std::ostream& {
-        if (use_color) {
-            os<<"\033[0m";
-        }
         return os.put(os.widen('\n')).flush();
     }
 
 
     Log l("default");
 
-    auto debug() -> std::ostream&   { return l.log(Level::DEBUG);  }
-    auto info() -> std::ostream&    { return l.log(Level::INFO);   }
-    auto notice() -> std::ostream&  { return l.log(Level::NOTICE); }
-    auto warning() -> std::ostream& { return l.log(Level::WARNING);}
-    auto error() -> std::ostream&   { return l.log(Level::ERROR);  }
+    auto debug(const char* file, int line) -> std::ostream&   { return l.log(Level::DEBUG, file, line);  }
+    auto info(const char* file, int line) -> std::ostream&    { return l.log(Level::INFO, file, line);   }
+    auto notice(const char* file, int line) -> std::ostream&  { return l.log(Level::NOTICE, file, line); }
+    auto warning(const char* file, int line) -> std::ostream& { return l.log(Level::WARNING, file, line);}
+    auto error(const char* file, int line) -> std::ostream&   { return l.log(Level::ERROR, file, line);  }
 
     void set_level(Level level, std::initializer_list<std::string> lognames) {
         if (lognames.size()==0) {
@@ -102,4 +408,4 @@ namespace Log {
             it->second->set_level(level);
         }
     }
-}
\ No newline at end of file
+}
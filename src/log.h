@@ -14,26 +14,37 @@ namespace Log {
         DEBUG,
     };
 
+    // Records are queued and written by the background thread, the logging
+    // thread never waits for output. Until init() and after exit records are
+    // written directly.
     extern void init();
     extern void set_level(Level level, std::initializer_list<std::string> lognames = {});
+    // "stderr" (default), "syslog" or a file path, false if the file isn't opened
+    extern auto output(const std::string& target) -> bool;
+    // records per second from one place of code, 0 - no limit
+    extern void rate_limit(int per_second);
 
-    extern auto debug() -> std::ostream&;
-    extern auto info() -> std::ostream&;
-    extern auto notice() -> std::ostream&;
-    extern auto warning() -> std::ostream&;
-    extern auto error() -> std::ostream&;
+    // file and line of the caller are the place of code for the rate limit
+    extern auto debug(const char* file = __builtin_FILE(), int line = __builtin_LINE()) -> std::ostream&;
+    extern auto info(const char* file = __builtin_FILE(), int line = __builtin_LINE()) -> std::ostream&;
+    extern auto notice(const char* file = __builtin_FILE(), int line = __builtin_LINE()) -> std::ostream&;
+    extern auto warning(const char* file = __builtin_FILE(), int line = __builtin_LINE()) -> std::ostream&;
+    extern auto error(const char* file = __builtin_FILE(), int line = __builtin_LINE()) -> std::ostream&;
 
     class Log {
     public:
         Log(std::string name);
         ~Log();
-        auto log(Level level) -> std::ostream&;
+        // the record ends by Log::endl or std::endl, arguments of disabled
+        // or rate limited records aren't formatted, file and line of the
+        // caller are the place of code for the rate limit
+        auto log(Level level, const char* file = __builtin_FILE(), int line = __builtin_LINE()) -> std::ostream&;
         void set_level(Level level);
-        auto debug() -> std::ostream& { return log(Level::DEBUG);  }
-        auto info() -> std::ostream& { return log(Level::INFO);  }
-        auto notice() -> std::ostream& { return log(Level::NOTICE);  }
-        auto warning() -> std::ostream& { return log(Level::WARNING);  }
-        auto error() -> std::ostream& { return log(Level::ERROR);  }
+        auto debug(const char* file = __builtin_FILE(), int line = __builtin_LINE()) -> std::ostream& { return log(Level::DEBUG, file, line);  }
+        auto info(const char* file = __builtin_FILE(), int line = __builtin_LINE()) -> std::ostream& { return log(Level::INFO, file, line);  }
+        auto notice(const char* file = __builtin_FILE(), int line = __builtin_LINE()) -> std::ostream& { return log(Level::NOTICE, file, line);  }
+        auto warning(const char* file = __builtin_FILE(), int line = __builtin_LINE()) -> std::ostream& { return log(Level::WARNING, file, line);  }
+        auto error(const char* file = __builtin_FILE(), int line = __builtin_LINE()) -> std::ostream& { return log(Level::ERROR, file, line);  }
     private:
         Level max_level = Level::DISABLE;
         std::string _name;
@@ -1,6 +1,7 @@
 #include <memory>
 #include <iostream>
 #include <forward_list>
+#include <vector>
 
 #include <csignal>
 #include <netdb.h>
@@ -20,6 +21,7 @@
 #include "impl/timer.h"
 #include "impl/udev.h"
 #include "impl/uart.h"
+#include "impl/pty.h"
 #include "impl/zeroconf.h"
 #include "impl/address.h"
 #include "sockaddr.h"
@@ -27,6 +29,9 @@
 #include "impl/tcpsvr.h"
 #include "impl/udpcli.h"
 #include "impl/udpsvr.h"
+#include "impl/tunnel.h"
+#include "impl/unix.h"
+#include "impl/shmring.h"
 #include "impl/stat.h"
 #include "impl/statobj.h"
 #include "impl/ofile.h"
@@ -50,6 +55,9 @@ public:
     auto uart(const std::string& name) -> std::unique_ptr<UART> override {
         return std::make_unique<UARTImpl>(name,this);
     }
+    auto pty(const std::string& name) -> std::unique_ptr<Pty> override {
+        return std::make_unique<PtyImpl>(name,this);
+    }
     //auto service_client(const std::string& name) -> std::unique_ptr<ServiceClient> override {}
     auto tcp_client(const std::string& name) -> std::unique_ptr<TcpClient> override {
         return std::make_unique<TcpClientImpl>(name,this);
@@ -63,6 +71,18 @@ public:
     auto udp_server(const std::string& name) -> std::unique_ptr<UdpServer> override {
         return std::make_unique<UdpServerImpl>(name,this);
     }
+    auto tunnel(const std::string& name) -> std::unique_ptr<Tunnel> override {
+        return std::make_unique<TunnelImpl>(name,this);
+    }
+    auto unix_server(const std::string& name) -> std::unique_ptr<UnixServer> override {
+        return std::make_unique<UnixServerImpl>(name,this);
+    }
+    auto unix_client(const std::string& name) -> std::unique_ptr<UnixClient> override {
+        return std::make_unique<UnixClientImpl>(name,this);
+    }
+    auto shm_ring(const std::string& name) -> std::unique_ptr<ShmRing> override {
+        return std::make_unique<ShmRingImpl>(name,this);
+    }
     // stats
     //auto stats() -> StatHandler& override {}
     // run
@@ -77,6 +97,7 @@ public:
         std::vector<epoll_event> events(_epoll_events_number);
         _loop_stop = false;
         while(!_loop_stop) {
+            run_deferred();
             int r = _epoll.wait(events.data(), events.size());
             if (r < 0) {
                 errno_c err;
@@ -92,53 +113,67 @@ public:
                 if (evs & EPOLLIN) {
                     //log.debug()<<"EPOLLIN"<<Log::endl;
                     int ret = obj->epollIN();
-                    auto s = _stat->time["in"].measure();
+                    auto s = _stat->collector("in").measure();
                     if (ret==IOPollable::NOT_HANDLED) log.warning()<<obj->name<<" EPOLLIN not handled"<<Log::endl;
                     if (ret==IOPollable::STOP) continue;
                 }
                 if (evs & EPOLLOUT) {
                     //log.debug()<<"EPOLLOUT"<<Log::endl;
-                    auto s = _stat->time["out"].measure();
+                    auto s = _stat->collector("out").measure();
                     int ret = obj->epollOUT();
                     if (ret==IOPollable::NOT_HANDLED) log.warning()<<obj->name<<" EPOLLOUT not handled"<<Log::endl;
                     if (ret==IOPollable::STOP) continue;
                 }
                 if (evs & EPOLLPRI) {
                     //log.debug()<<"EPOLLPRI"<<Log::endl;
-                    auto s = _stat->time["pri"].measure();
+                    auto s = _stat->collector("pri").measure();
                     int ret = obj->epollPRI();
                     if (ret==IOPollable::NOT_HANDLED) log.warning()<<obj->name<<" EPOLLPRI not handled"<<Log::endl;
                     if (ret==IOPollable::STOP) continue;
                 }
                 if (evs & EPOLLERR) {
                     //log.debug()<<"EPOLLERR"<<Log::endl;
-                    auto s = _stat->time["err"].measure();
+                    auto s = _stat->collector("err").measure();
                     int ret = obj->epollERR();
                     if (ret==IOPollable::NOT_HANDLED) log.warning()<<obj->name<<" EPOLLERR not handled"<<Log::endl;
                     if (ret==IOPollable::STOP) continue;
                 }
                 if (evs & EPOLLHUP) {
                     //log.debug()<<"EPOLLHUP"<<Log::endl;
-                    auto s = _stat->time["hup"].measure();
+                    auto s = _stat->collector("hup").measure();
                     int ret = obj->epollHUP();
                     if (ret==IOPollable::NOT_HANDLED) log.warning()<<obj->name<<" EPOLLHUP not handled"<<Log::endl;
                     if (ret==IOPollable::STOP) continue;
                 }
                 if (evs & EPOLLRDHUP) {
                     //log.debug()<<"EPOLLRDHUP"<<Log::endl;
-                    auto s = _stat->time["rdhup"].measure();
+                    auto s = _stat->collector("rdhup").measure();
                     int ret = obj->epollRDHUP();
                     if (ret==IOPollable::NOT_HANDLED) log.warning()<<obj->name<<" EPOLLRDHUP not handled"<<Log::endl;
                     if (ret==IOPollable::STOP) continue;
                 }
             }
         }
-        for (auto w : _iowatches) { w->cleanup();
+        // cleanup may delete other watches, as a peer socket of a server
+        while (!_iowatches.empty()) {
+            auto* w = _iowatches.front();
+            _iowatches.pop_front();
+            w->cleanup();
         }
-        _iowatches.clear();
+        _deferred.clear();
         log.debug()<<"run end"<<Log::endl;
     }
     void stop() override {_loop_stop = true;}
+
+    void defer(OnEvent func) override { _deferred.push_back(std::move(func));
+    }
+    void run_deferred() {
+        while (!_deferred.empty()) {
+            auto funcs = std::move(_deferred);
+            _deferred.clear();
+            for (auto& func : funcs) func();
+        }
+    }
     
     //auto handle_udev() -> error_c override {}
     //auto handle_zeroconf() -> error_c override {}
@@ -235,6 +270,7 @@ public:
     bool _block_udev = false;
     bool _block_zeroconf = false;
     std::forward_list<IOPollable*> _iowatches;
+    std::vector<OnEvent> _deferred;
     std::unique_ptr<Signal> ctrlC_handler;
     std::unique_ptr<UDevIO> _udev;
     std::unique_ptr<AvahiImpl> _zeroconf;
@@ -17,6 +17,8 @@ public:
     virtual auto udev() -> UdevLoop* = 0;
     virtual auto zeroconf() -> Avahi* = 0;
     virtual auto address() -> std::unique_ptr<AddressResolver> = 0;
+    // func is called after events of the current loop turn are handled
+    virtual void defer(OnEvent func) = 0;
     static auto loop(int pool_events=5) -> std::unique_ptr<IOLoopSvc>;
 };
 
@@ -0,0 +1,248 @@
+#ifndef __SHMRING__H__
+#define __SHMRING__H__
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// Packet rings in shared memory (/dev/shm/<name>) for local processes.
+// The segment has two single producer single consumer rings: down (router
+// to client) and up (client to router). Packets are framed by 32 bit length
+// and aligned to 8 bytes, a packet which doesn't fit to the end of the ring
+// starts from its beginning after a wrap mark. Producer and consumer don't
+// make any syscall while the consumer is busy. An idle consumer sets the
+// waiting flag and sleeps on the doorbell FIFO (/dev/shm/<name>.down or
+// .up), the producer writes a byte there only if the flag is set.
+// This header has no dependencies, clients can include it alone.
+namespace shmring {
+
+constexpr uint32_t MAGIC = 0x55415652; // UAVR
+constexpr uint32_t VERSION = 1;
+constexpr uint32_t WRAP = 0xFFFFFFFF;
+constexpr size_t ALIGN = 8;
+
+struct alignas(64) Ring {
+    alignas(64) std::atomic<uint64_t> head;  // bytes written, producer only
+    alignas(64) std::atomic<uint64_t> tail;  // bytes read, consumer only
+    std::atomic<uint32_t> waiting;           // consumer sleeps on the doorbell
+    std::atomic<uint32_t> dropped;           // packets the ring had no space for
+    uint64_t capacity;                       // power of 2
+    uint64_t offset;                         // of data from the segment start
+};
+
+struct Header {
+    uint32_t magic;
+    uint32_t version;
+    int64_t pid;    // of the router
+    Ring down;
+    Ring up;
+};
+
+inline auto frame_size(size_t len) -> size_t {
+    return (sizeof(uint32_t)+len+ALIGN-1) & ~(ALIGN-1);
+}
+inline auto segment_size(size_t capacity) -> size_t {
+    return sizeof(Header)+2*capacity;
+}
+inline auto bell_path(const std::string& name, const char* dir) -> std::string {
+    return "/dev/shm/"+name+"."+dir;
+}
+
+// Producer and consumer operations on one ring of a mapped segment. The
+// other side may write anything to the segment, so the capacity is kept
+// locally and positions and lengths are checked before use.
+class Queue {
+public:
+    Queue() = default;
+    Queue(Ring* ring, uint8_t* data, int bell): _ring(ring), _data(data), _bell(bell), _cap(ring->capacity) {}
+
+    // false if there is no space, the packet is dropped then
+    auto write(const void* buf, size_t len) -> bool {
+        uint64_t cap = _cap;
+        size_t size = frame_size(len);
+        if (size>cap/2) return drop();
+        uint64_t head = _ring->head.load(std::memory_order_relaxed);
+        uint64_t tail = _ring->tail.load(std::memory_order_acquire);
+        uint64_t pos = head & (cap-1);
+        uint64_t rest = cap-pos; // contiguous space to the end
+        uint64_t need = size>rest ? rest+size : size;
+        uint64_t used = head-tail;
+        if (used>cap || cap-used<need) return drop();
+        if (size>rest) {
+            store_len(pos, WRAP);
+            head += rest;
+            pos = 0;
+        }
+        store_len(pos, len);
+        std::memcpy(_data+pos+sizeof(uint32_t), buf, len);
+        _ring->head.store(head+size, std::memory_order_release);
+        // pairs with the fence of the consumer going to sleep
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_ring->waiting.load(std::memory_order_relaxed)) {
+            _ring->waiting.store(0, std::memory_order_relaxed);
+            char c = 0;
+            (void)::write(_bell, &c, 1); // a full FIFO means the consumer is woken already
+        }
+        return true;
+    }
+    // Calls func(data, len) for available packets, data points to the ring
+    // and is valid inside the call only. Returns number of packets, -1 if
+    // the producer broke the ring, skip() it then.
+    template<typename Func>
+    auto read(Func func) -> int {
+        uint64_t cap = _cap;
+        uint64_t tail = _ring->tail.load(std::memory_order_relaxed);
+        uint64_t head = _ring->head.load(std::memory_order_acquire);
+        if (head-tail>cap) return -1;
+        int count = 0;
+        while (tail!=head) {
+            uint64_t pos = tail & (cap-1);
+            uint64_t rest = cap-pos;
+            uint32_t len;
+            std::memcpy(&len, _data+pos, sizeof(len));
+            if (len==WRAP) {
+                if (rest>head-tail) return -1;
+                tail += rest;
+                continue;
+            }
+            if (len>rest-sizeof(uint32_t) || frame_size(len)>head-tail) return -1;
+            func(_data+pos+sizeof(uint32_t), int(len));
+            tail += frame_size(len);
+            count++;
+        }
+        _ring->tail.store(tail, std::memory_order_release);
+        return count;
+    }
+    // Sets the waiting flag, false if a packet came meanwhile.
+    // The consumer sleeps on the doorbell after true.
+    auto sleep() -> bool {
+        drain_bell();
+        _ring->waiting.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_ring->head.load(std::memory_order_relaxed)!=_ring->tail.load(std::memory_order_relaxed)) {
+            _ring->waiting.store(0, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+    void drain_bell() {
+        char buf[64];
+        while (::read(_bell, buf, sizeof(buf))>0) {}
+    }
+    // packets are read from now on
+    void skip() {
+        _ring->tail.store(_ring->head.load(std::memory_order_acquire), std::memory_order_release);
+    }
+    auto dropped() const -> uint32_t { return _ring->dropped.load(std::memory_order_relaxed);
+    }
+private:
+    auto drop() -> bool {
+        _ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    void store_len(uint64_t pos, uint32_t len) {
+        std::memcpy(_data+pos, &len, sizeof(len));
+    }
+    Ring* _ring = nullptr;
+    uint8_t* _data = nullptr;
+    int _bell = -1;
+    uint64_t _cap = 0;
+};
+
+// Client side of the segment created by the router
+class Client {
+public:
+    Client() = default;
+    Client(const Client&) = delete;
+    auto operator=(const Client&) -> Client& = delete;
+    ~Client() { close();
+    }
+    // returns errno value, 0 on success
+    auto open(const std::string& name) -> int {
+        close();
+        int fd = shm_open(("/"+name).c_str(), O_RDWR | O_CLOEXEC, 0);
+        if (fd==-1) return errno;
+        struct stat st{};
+        if (fstat(fd,&st)==-1 || size_t(st.st_size)<sizeof(Header)) {
+            ::close(fd);
+            return EINVAL;
+        }
+        void* map = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (map==MAP_FAILED) return errno;
+        _map = map;
+        _size = st.st_size;
+        auto* hdr = static_cast<Header*>(map);
+        if (hdr->magic!=MAGIC || hdr->version!=VERSION || segment_size(hdr->down.capacity)>_size) {
+            close();
+            return EPROTO;
+        }
+        // O_RDWR: the FIFO doesn't wait for the other side and never reports its end
+        _down_bell = ::open(bell_path(name,"down").c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        _up_bell = ::open(bell_path(name,"up").c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (_down_bell==-1 || _up_bell==-1) {
+            int ec = errno;
+            close();
+            return ec;
+        }
+        auto* base = static_cast<uint8_t*>(map);
+        _down = Queue(&hdr->down, base+hdr->down.offset, _down_bell);
+        _up = Queue(&hdr->up, base+hdr->up.offset, _up_bell);
+        _down.skip(); // packets of the previous client
+        return 0;
+    }
+    auto is_open() const -> bool { return _map!=nullptr;
+    }
+    // packets from the router, see Queue::read(), a broken ring is skipped
+    template<typename Func>
+    auto read(Func func) -> int {
+        int n = _down.read(func);
+        if (n<0) _down.skip();
+        return n;
+    }
+    // waits for packets from the router up to timeout_ms (-1 - forever),
+    // returns false on timeout
+    auto wait(int timeout_ms) -> bool {
+        if (!_down.sleep()) return true;
+        pollfd pfd{_down_bell, POLLIN, 0};
+        int ret = ::poll(&pfd, 1, timeout_ms);
+        return ret>0;
+    }
+    // descriptor to wait with other ones in own loop, call prepare() before
+    // waiting, if it returns false packets are available already
+    auto fd() const -> int { return _down_bell;
+    }
+    auto prepare() -> bool { return _down.sleep();
+    }
+    // packet to the router, false if the ring is full
+    auto write(const void* buf, size_t len) -> bool { return _up.write(buf, len);
+    }
+    auto dropped() const -> uint32_t { return _down.dropped();
+    }
+    void close() {
+        if (_down_bell!=-1) ::close(_down_bell);
+        if (_up_bell!=-1) ::close(_up_bell);
+        _down_bell = _up_bell = -1;
+        if (_map) munmap(_map,_size);
+        _map = nullptr;
+    }
+
+private:
+    void* _map = nullptr;
+    size_t _size = 0;
+    int _down_bell = -1;
+    int _up_bell = -1;
+    Queue _down;
+    Queue _up;
+};
+
+} // namespace shmring
+
+#endif  //!__SHMRING__H__
@@ -0,0 +1,148 @@
+#ifndef __SHMSTAT__H__
+#define __SHMSTAT__H__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Counters segment in shared memory (/dev/shm/<name>).
+// Router keeps every registered counter in an entry, values are updated
+// in place with relaxed atomic stores. Directory (entry keys and kinds) is
+// protected by a seqlock: writer makes seq odd while it changes entries.
+// Readers don't need any syscall after open. This header has no
+// dependencies, external monitors can include it alone.
+namespace shmstat {
+
+constexpr uint32_t MAGIC = 0x55415653; // UAVS
+constexpr uint32_t VERSION = 1;
+constexpr int KEY_SIZE = 112;
+
+enum Kind : uint32_t {
+    FREE = 0,
+    COUNTER = 1,    // events or bytes
+    DURATION = 2,   // nanoseconds
+};
+
+struct Entry {
+    std::atomic<int64_t> value;
+    uint32_t kind;
+    uint32_t reserved;
+    char key[KEY_SIZE]; // "measurement,tag=value field", zero terminated
+};
+
+struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t entry_size;
+    std::atomic<uint32_t> seq;
+    std::atomic<uint32_t> count; // entries in use are below count
+    int64_t pid;
+};
+
+inline auto segment_size(uint32_t capacity) -> size_t {
+    return sizeof(Header)+size_t(capacity)*sizeof(Entry);
+}
+
+struct Sample {
+    std::string key;
+    Kind kind;
+    int64_t value;
+};
+
+class Reader {
+public:
+    Reader() = default;
+    Reader(const Reader&) = delete;
+    auto operator=(const Reader&) -> Reader& = delete;
+    ~Reader() { close();
+    }
+    // returns errno value, 0 on success
+    auto open(const std::string& name) -> int {
+        close();
+        int fd = shm_open(("/"+name).c_str(), O_RDONLY | O_CLOEXEC, 0);
+        if (fd==-1) return errno;
+        struct stat st{};
+        if (fstat(fd,&st)==-1 || size_t(st.st_size)<sizeof(Header)) {
+            ::close(fd);
+            return EINVAL;
+        }
+        void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (map==MAP_FAILED) return errno;
+        _map = map;
+        _size = st.st_size;
+        _hdr = static_cast<const Header*>(map);
+        if (_hdr->magic!=MAGIC || _hdr->version!=VERSION || _hdr->entry_size!=sizeof(Entry) ||
+            segment_size(_hdr->capacity)>_size) {
+            close();
+            return EPROTO;
+        }
+        _entries = reinterpret_cast<const Entry*>(_hdr+1);
+        return 0;
+    }
+    auto is_open() const -> bool { return _map!=nullptr;
+    }
+    auto pid() const -> int64_t { return _hdr ? _hdr->pid : 0;
+    }
+    // directory version, pointers returned by find() are valid while it is the same
+    auto seq() const -> uint32_t { return _hdr->seq.load(std::memory_order_acquire);
+    }
+    // consistent copy of the directory with current values
+    auto snapshot(std::vector<Sample>& out) const -> bool {
+        for(int retry=0;retry<100;retry++) {
+            uint32_t s1 = seq();
+            if (s1&1) continue;
+            out.clear();
+            uint32_t count = std::min(_hdr->count.load(std::memory_order_acquire), _hdr->capacity);
+            for(uint32_t i=0;i<count;i++) {
+                auto& e = _entries[i];
+                if (e.kind==FREE) continue;
+                out.push_back({std::string(e.key, strnlen(e.key,KEY_SIZE)), Kind(e.kind), e.value.load(std::memory_order_relaxed)});
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (_hdr->seq.load(std::memory_order_relaxed)==s1) return true;
+        }
+        return false;
+    }
+    // value of one entry to be sampled without copying the directory
+    auto find(const std::string& key) const -> const std::atomic<int64_t>* {
+        for(int retry=0;retry<100;retry++) {
+            uint32_t s1 = seq();
+            if (s1&1) continue;
+            const std::atomic<int64_t>* ret = nullptr;
+            uint32_t count = std::min(_hdr->count.load(std::memory_order_acquire), _hdr->capacity);
+            for(uint32_t i=0;i<count && !ret;i++) {
+                auto& e = _entries[i];
+                if (e.kind!=FREE && strncmp(e.key,key.c_str(),KEY_SIZE)==0) ret = &e.value;
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (_hdr->seq.load(std::memory_order_relaxed)==s1) return ret;
+        }
+        return nullptr;
+    }
+    void close() {
+        if (_map) munmap(_map,_size);
+        _map = nullptr;
+        _hdr = nullptr;
+        _entries = nullptr;
+    }
+
+private:
+    void* _map = nullptr;
+    size_t _size = 0;
+    const Header* _hdr = nullptr;
+    const Entry* _entries = nullptr;
+};
+
+} // namespace shmstat
+
+#endif  //!__SHMSTAT__H__
@@ -0,0 +1,109 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+using namespace std::chrono_literals;
+
+#include "log.h"
+#include "ioloop.h"
+
+// Stats exporter against a local stand-in of influxdb http api.
+// The stand-in answers 503 and drops the connection from time to time,
+// all "tick" values has to arrive once and in order.
+
+class StandIn {
+public:
+    StandIn(IOLoop* loop, int port):_svr(loop->tcp_server("InfluxStandIn")) {
+        _svr->on_connect([this](std::shared_ptr<Client> cli, std::string name){
+            _cli = cli;
+            _cli->on_read([this](void* buf, int len){ on_request(static_cast<char*>(buf),len); });
+            _cli->on_close([this](){ _cli.reset(); });
+            std::cout<<"Accept from "<<name<<std::endl;
+        });
+        _svr->on_error([](const error_c& ec) {
+            std::cout<<"Stand-in error:"<<ec<<std::endl;
+        });
+        _svr->init(port);
+    }
+    void on_request(const char* buf, int len) {
+        _input.append(buf,len);
+        auto end = _input.find("\r\n\r\n");
+        if (end==std::string::npos) return;
+        auto pos = _input.find("Content-Length: ");
+        size_t length = std::stoul(_input.substr(pos+16));
+        if (_input.size()<end+4+length) return;
+        std::string body = _input.substr(end+4,length);
+        _input.erase(0,end+4+length);
+        _requests++;
+        if (_requests%7==0) {
+            reply("HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n");
+            return;
+        }
+        if (_requests%11==0) {
+            std::cout<<"Drop connection"<<std::endl;
+            _cli.reset();
+            return;
+        }
+        for(auto pos = body.find("tick="); pos!=std::string::npos; pos = body.find("tick=",pos+1)) {
+            long long value = std::stoll(body.substr(pos+5));
+            if (value!=_last+1) {
+                std::cout<<"Unexpected tick "<<value<<" after "<<_last<<std::endl;
+            }
+            _last = value;
+        }
+        reply("HTTP/1.1 204 No Content\r\n\r\n");
+    }
+    void reply(const std::string& msg) {
+        if (_cli) _cli->write(msg.data(),msg.size());
+    }
+    auto last() -> long long { return _last;
+    }
+private:
+    std::unique_ptr<TcpServer> _svr;
+    std::shared_ptr<Client> _cli;
+    std::string _input;
+    int _requests = 0;
+    long long _last = 0;
+};
+
+class Ticks : public Stat {
+public:
+    void report(OStat& out) override {
+        auto& meter = metric("test");
+        meter.add_field("tick", ++value);
+        out.send(meter);
+    }
+    long long value = 0;
+};
+
+int main(int argc, char** argv) {
+    Log::init();
+    Log::set_level(Log::Level::DEBUG,{"ioloop","stats","tcpclient","tcpserver"});
+#ifdef YAML_CONFIG
+    int port = 18086;
+    if (argc>1) port = std::stoi(argv[1]);
+    auto loop = IOLoop::loop();
+    error_c ec = loop->handle_CtrlC();
+    if (ec) {
+        std::cout<<"Ctrl-C handler error "<<ec<<std::endl;
+        return 1;
+    }
+    StandIn standin(loop.get(), port);
+    auto cfg = YAML::Load("{http: {address: 127.0.0.1, port: "+std::to_string(port)+"}, packsize: 200, spill: {file: /tmp/test-influx.spill, size: 65536}}");
+    ec = loop->stats()->init_yaml(nullptr, cfg);
+    if (ec) {
+        std::cout<<"Stats output error "<<ec<<std::endl;
+        return 1;
+    }
+    auto ticks = std::make_shared<Ticks>();
+    loop->stats()->register_report(ticks, 10ms);
+    auto stop = loop->timer();
+    stop->shoot([&loop, &standin, &ticks](){
+        std::cout<<"Sent "<<ticks->value<<" received "<<standin.last()<<std::endl;
+        loop->stop();
+    }).arm_oneshoot(10s);
+    loop->run();
+#else
+    std::cout<<"Built without YAML_CONFIG"<<std::endl;
+#endif
+    return 0;
+}
@@ -0,0 +1,78 @@
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "shmring.h"
+
+// Reads packets routed to a ring endpoint of running uav-router.
+// uavr-ring [-n name] [-x] [-i interval_ms]
+// Prints size of every packet, with -x its bytes in hex, with interval
+// only packet and byte rates are printed.
+
+static void usage(const char* prog) {
+    std::cerr<<"Usage: "<<prog<<" [-n segment] [-x] [-i interval_ms]"<<std::endl;
+}
+
+int main(int argc, char** argv) {
+    std::string name = "ring";
+    bool hex = false;
+    int interval = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:xi:h")) != -1) {
+        switch (opt) {
+        case 'n': name = optarg;
+            break;
+        case 'x': hex = true;
+            break;
+        case 'i': interval = std::stoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    shmring::Client ring;
+    int ec = ring.open(name);
+    if (ec) {
+        std::cerr<<"Can't open segment "<<name<<": "<<strerror(ec)<<std::endl;
+        return 2;
+    }
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+    auto last = std::chrono::steady_clock::now();
+    while(true) {
+        int n = ring.read([&](uint8_t* data, int len) {
+            packets++;
+            bytes += len;
+            if (interval) return;
+            std::cout<<len;
+            if (hex) {
+                char buf[4];
+                std::cout<<':';
+                for(int i=0;i<len;i++) {
+                    snprintf(buf, sizeof(buf), " %02x", data[i]);
+                    std::cout<<buf;
+                }
+            }
+            std::cout<<'\n';
+        });
+        if (!interval) {
+            if (n) std::cout<<std::flush;
+            ring.wait(-1);
+            continue;
+        }
+        auto now = std::chrono::steady_clock::now();
+        double dt = std::chrono::duration<double>(now-last).count();
+        if (dt*1000>=interval) {
+            std::cout<<packets/dt<<" packets/s "<<bytes/dt<<" B/s dropped "<<ring.dropped()<<std::endl;
+            packets = bytes = 0;
+            last = now;
+        }
+        if (!n) ring.wait(interval);
+    }
+    return 0;
+}
@@ -0,0 +1,74 @@
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "shmstat.h"
+
+// Prints counters of running uav-router from shared memory segment.
+// uavr-stat [-n name] [-i interval_ms] [filter]
+// With interval the values are printed repeatedly together with rate per
+// second since the previous sample.
+
+static void usage(const char* prog) {
+    std::cerr<<"Usage: "<<prog<<" [-n segment] [-i interval_ms] [filter]"<<std::endl;
+}
+
+int main(int argc, char** argv) {
+    std::string name = "uav-router";
+    int interval = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:i:h")) != -1) {
+        switch (opt) {
+        case 'n': name = optarg;
+            break;
+        case 'i': interval = std::stoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    std::string filter;
+    if (optind<argc) filter = argv[optind];
+
+    shmstat::Reader reader;
+    int ec = reader.open(name);
+    if (ec) {
+        std::cerr<<"Can't open segment "<<name<<": "<<strerror(ec)<<std::endl;
+        return 2;
+    }
+    std::vector<shmstat::Sample> samples;
+    std::map<std::string,int64_t> prev;
+    auto last = std::chrono::steady_clock::now();
+    while(true) {
+        if (!reader.snapshot(samples)) {
+            std::cerr<<"Segment is being changed, try later"<<std::endl;
+            return 3;
+        }
+        auto now = std::chrono::steady_clock::now();
+        double dt = std::chrono::duration<double>(now-last).count();
+        last = now;
+        for(auto& s : samples) {
+            if (!filter.empty() && s.key.find(filter)==std::string::npos) continue;
+            std::cout<<s.key<<" "<<s.value;
+            if (s.kind==shmstat::DURATION) std::cout<<"ns";
+            if (interval) {
+                auto it = prev.find(s.key);
+                if (it!=prev.end() && dt>0) std::cout<<" "<<(s.value-it->second)/dt<<"/s";
+                prev[s.key] = s.value;
+            }
+            std::cout<<'\n';
+        }
+        std::cout<<std::flush;
+        if (!interval) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(interval));
+        std::cout<<'\n';
+    }
+    return 0;
+}